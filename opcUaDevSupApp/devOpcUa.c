@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <errlog.h>
 
 // #EPICS LIBS
@@ -59,6 +60,7 @@
 
 #include <devOpcUa.h>
 #include <drvOpcUa.h>
+#include <devUaTrace.h>
 
 #ifdef _WIN32
 __inline int debug_level(dbCommon *prec) {
@@ -73,6 +75,7 @@ inline int debug_level(dbCommon *prec) {
 static  long         read(dbCommon *prec);
 static  long         write(dbCommon *prec);
 static  void         outRecordCallback(CALLBACK *pcallback);
+static  void         deferredWriteCallback(CALLBACK *pcallback);
 static  long         get_ioint_info(int cmd, dbCommon *prec, IOSCANPVT * ppvt);
 
 //extern int OpcUaInitItem(char *OpcUaName, dbCommon* pRecord, OPCUA_ItemINFO** uaItem);
@@ -199,7 +202,7 @@ epicsExportAddress(dset,devwaveformOpcUa);
 static void opcuaMonitorControl (initHookState state)
 {
     switch (state) {
-    case initHookAfterFinishDevSup:
+    case initHookAfterIocRunning:      /* in the background, records are INVALID until data arrives */
         OpcUaSetupMonitors();
         break;
     default:
@@ -218,9 +221,214 @@ long init (int after)
     return 0;
 }
 
-long init_common (dbCommon *prec, struct link* plnk, int recType, void *val, int inpType, void *inpVal)
+/* Link options: the item path may be followed by blank separated 'key=value' pairs.
+ *   iogroup=NAME   IN records: share one I/O scan list with all records of group NAME.
+ *                  The group is scanned once per data update of the server.
+ *   deadband=X[%]      Absolute deadband or percent of the EURange of the node.
+ *   trigger=status|value|timestamp  Report changes of status, status+value (default) or status+value+timestamp.
+ *   buffer=value|time  Waveforms of a scalar node: collect all samples (or their timestamps)
+ *                      received since the last processing, the queue size defaults to NELM.
+ *   ts=source|server   Timestamp used for TSE=-2, default is server.
+ *   sub=NAME           Subscription group NAME, defined by opcuaSubscription().
+ *   sampling=MS        Sampling interval of the server [ms].
+ *   queue=N            Queue size of the server, N values per publish.
+ *   discard=old|new    Drop the oldest or the newest value if the server queue is full.
+ *   poll=MS        IN records: don't monitor, read every MS [ms]. The records of a session with the
+ *                  same poll and maxage are read by one Read call and scanned together (I/O Intr).
+ *   maxage=MS      poll: the server may return a cached value not older than MS [ms].
+ */
+#define LINKOPTIONLEN 64
+static long badLinkOption(dbCommon *prec, const char *opt, const char *val)
+{
+    errlogPrintf("%s devOpcUa: bad value in link option '%s=%s'\n", prec->name, opt, val);
+    recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) Bad link option");
+    return S_db_badField;
+}
+
+static long parseLinkOptions(dbCommon *prec, OPCUA_ItemINFO *uaItem, const char *options)
+{
+    char opt[LINKOPTIONLEN];
+    char *val;
+    size_t len;
+
+    while(1) {
+        options += strspn(options, " \t");
+        len = strcspn(options, " \t");
+        if(!len)
+            return 0;
+        if(len >= LINKOPTIONLEN) {
+            recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) link option too long");
+            return S_db_badField;
+        }
+        memcpy(opt, options, len);
+        opt[len] = 0;
+        options += len;
+
+        val = strchr(opt, '=');
+        if(!val || !val[1]) {
+            errlogPrintf("%s devOpcUa: option '%s' needs a value (key=value)\n", prec->name, opt);
+            recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) Bad link option");
+            return S_db_badField;
+        }
+        *val++ = 0;
+
+        if(!strcmp(opt, "iogroup")) {
+            if(uaItem->inpDataType) {
+                recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) option 'iogroup' is for IN records only");
+                return S_db_badField;
+            }
+            uaItem->ioscanpvt = getIoScanGroup(val);
+            uaItem->ioScanGroup = 1;
+        }
+        else if(!strcmp(opt, "poll") || !strcmp(opt, "maxage")) {
+            char *end;
+            double d = strtod(val, &end);
+            if(uaItem->inpDataType) {
+                errlogPrintf("%s devOpcUa: option '%s' is for IN records only\n", prec->name, opt);
+                recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) Bad link option");
+                return S_db_badField;
+            }
+            if(*end || d < 0 || (opt[0] == 'p' && d == 0))
+                return badLinkOption(prec, opt, val);
+            if(opt[0] == 'p')
+                uaItem->pollInterval = d / 1000.0;
+            else
+                uaItem->maxAge = d;
+        }
+        else if(!strcmp(opt, "session")) {
+            uaItem->session = getSession(val);
+            if(uaItem->session < 0) {
+                errlogPrintf("%s devOpcUa: session '%s' not defined, see drvOpcuaSetup()\n", prec->name, val);
+                return badLinkOption(prec, opt, val);
+            }
+        }
+        else if(!strcmp(opt, "sub") || !strcmp(opt, "subscription")) {
+            uaItem->subscription = getSubscriptionGroup(val);
+            if(uaItem->subscription < 0) {
+                errlogPrintf("%s devOpcUa: subscription '%s' not defined, see opcuaSubscription()\n", prec->name, val);
+                return badLinkOption(prec, opt, val);
+            }
+        }
+        else if(!strcmp(opt, "sampling")) {
+            char *end;
+            uaItem->samplingInterval = strtod(val, &end);
+            if(*end || uaItem->samplingInterval < 0)
+                return badLinkOption(prec, opt, val);
+        }
+        else if(!strcmp(opt, "queue")) {
+            char *end;
+            long n = strtol(val, &end, 10);
+            if(*end || n < 1)
+                return badLinkOption(prec, opt, val);
+            uaItem->queueSize = n;
+        }
+        else if(!strcmp(opt, "discard")) {
+            if(!strcmp(val, "old"))
+                uaItem->discardOldest = 1;
+            else if(!strcmp(val, "new"))
+                uaItem->discardOldest = 0;
+            else
+                return badLinkOption(prec, opt, val);
+        }
+        else if(!strcmp(opt, "deadband")) {
+            uaItem->deadbandType = parseDeadband(val, &uaItem->deadband);
+            if(uaItem->deadbandType < 0)
+                return badLinkOption(prec, opt, val);
+        }
+        else if(!strcmp(opt, "trigger")) {
+            uaItem->trigger = parseTrigger(val);
+            if(uaItem->trigger < 0)
+                return badLinkOption(prec, opt, val);
+        }
+        else if(!strcmp(opt, "buffer")) {
+            if(!strcmp(val, "value"))
+                uaItem->buffered = BUFFER_VALUE;
+            else if(!strcmp(val, "time"))
+                uaItem->buffered = BUFFER_TIME;
+            else
+                return badLinkOption(prec, opt, val);
+        }
+        else if(!strcmp(opt, "write")) {
+            if(!uaItem->inpDataType) {
+                recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) option 'write' is for OUT records only");
+                return S_db_badField;
+            }
+            if(!strcmp(val, "latest"))
+                uaItem->coalesce = 1;
+            else if(!strcmp(val, "wait"))
+                uaItem->coalesce = 0;
+            else
+                return badLinkOption(prec, opt, val);
+        }
+        else if(!strcmp(opt, "odeadband") || !strcmp(opt, "minwrite")) {
+            char *end;
+            double d = strtod(val, &end);
+            if(!uaItem->inpDataType) {
+                errlogPrintf("%s devOpcUa: option '%s' is for OUT records only\n", prec->name, opt);
+                recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) Bad link option");
+                return S_db_badField;
+            }
+            if(*end || d < 0)
+                return badLinkOption(prec, opt, val);
+            if(opt[0] == 'o')
+                uaItem->outDeadband = d;
+            else
+                uaItem->minWriteInterval = d / 1000.0;
+        }
+        else if(!strcmp(opt, "ts")) {
+            if(!strcmp(val, "source"))
+                uaItem->tsSource = 1;
+            else if(!strcmp(val, "server"))
+                uaItem->tsSource = 0;
+            else
+                return badLinkOption(prec, opt, val);
+        }
+        else {
+            errlogPrintf("%s devOpcUa: unknown link option '%s'\n", prec->name, opt);
+            recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) Bad link option");
+            return S_db_badField;
+        }
+    }
+}
+
+/* Waveforms: NELM and the sample buffer of the link option 'buffer'. Done before the item is
+ * registered, the driver must never see a buffered item without its buffer.
+ */
+static long initArray(dbCommon *prec, OPCUA_ItemINFO *uaItem, int nelm)
+{
+    if(!nelm) {
+        if(uaItem->buffered) {
+            recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) option 'buffer' is for waveform records only");
+            return S_db_badField;
+        }
+        return 0;
+    }
+    uaItem->isArray = 1;
+    uaItem->arraySize = nelm;
+    if(!uaItem->buffered)
+        return 0;
+    if(uaItem->recDataType == epicsOldStringT || uaItem->recDataType == epicsEnum16T ||
+       (uaItem->buffered == BUFFER_TIME && uaItem->recDataType != epicsFloat64T)) {
+        recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) option 'buffer' needs a numeric FTVL, DOUBLE for 'time'");
+        return S_db_badField;
+    }
+    uaItem->pBuffer = calloc(nelm, epicsTypeSizes[uaItem->recDataType]);
+    if(!uaItem->pBuffer) {
+        recGblRecordError(S_db_noMemory, prec, "devOpcUa (init_record) Out of memory, calloc() failed");
+        return S_db_noMemory;
+    }
+    if(uaItem->queueSize == QUEUE_NOT_SET)
+        uaItem->queueSize = nelm;
+    return 0;
+}
+
+/* nelm: waveforms NELM, 0 for scalar records */
+long init_common (dbCommon *prec, struct link* plnk, int recType, void *val, int inpType, void *inpVal, int nelm)
 {
     OPCUA_ItemINFO* uaItem;
+    const char *link;
+    size_t pathLen;
+    long status;
 
     if(plnk->type != INST_IO) {
         long status;
@@ -236,9 +444,10 @@ long init_common (dbCommon *prec, struct link* plnk, int recType, void *val, int
         return status;
     }
 
-    if(strlen(plnk->value.instio.string) < ITEMPATHLEN) {
-        strcpy(uaItem->ItemPath,plnk->value.instio.string);
-        addOPCUA_Item(uaItem);
+    link = plnk->value.instio.string;
+    pathLen = strcspn(link, " \t");
+    if(pathLen < ITEMPATHLEN) {
+        memcpy(uaItem->ItemPath,link,pathLen);
     }
     else {
         long status = S_db_badField;
@@ -252,6 +461,13 @@ long init_common (dbCommon *prec, struct link* plnk, int recType, void *val, int
     uaItem->prec = prec;
     uaItem->debug = prec->tpro;
     uaItem->flagLock = epicsMutexMustCreate();
+    uaItem->samplingInterval = DEFAULT_SAMPLING_INTERVAL;
+    uaItem->queueSize = QUEUE_NOT_SET;
+    uaItem->discardOldest = 1;
+    uaItem->trigger = FILTER_DEFAULT;
+    uaItem->deadbandType = FILTER_DEFAULT;
+    uaItem->outDeadband = -1.0;
+    uaItem->stat = 1;                   /* INVALID until the first data from the server */
     if(uaItem->debug >= 2)
         errlogPrintf("init_common %s\t PACT= %i, recVal=%p\n", prec->name, prec->pact, uaItem->pRecVal);
     // get OPC item type in init -> after
@@ -261,10 +477,57 @@ long init_common (dbCommon *prec, struct link* plnk, int recType, void *val, int
         uaItem->pInpVal = inpVal;
         callbackSetCallback(outRecordCallback, &(uaItem->callback));
         callbackSetUser(prec, &(uaItem->callback));
+        callbackSetCallback(deferredWriteCallback, &(uaItem->deferCallback));
+        callbackSetUser(prec, &(uaItem->deferCallback));
+        callbackSetPriority(prec->prio, &(uaItem->deferCallback));
     }
-    else {
+
+    status = parseLinkOptions(prec, uaItem, link + pathLen);
+    if(!status)
+        status = initArray(prec, uaItem, nelm);
+    if(uaItem->queueSize == QUEUE_NOT_SET)
+        uaItem->queueSize = DEFAULT_QUEUE_SIZE;
+    if(status) {
+        prec->dpvt = NULL;
+        epicsMutexDestroy(uaItem->flagLock);
+        free(uaItem->pBuffer);
+        free(uaItem);
+        return status;
+    }
+
+    if(uaItem->maxAge > 0 && !uaItem->pollInterval) {
+        recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) option 'maxage' needs 'poll'");
+        prec->dpvt = NULL;
+        epicsMutexDestroy(uaItem->flagLock);
+        free(uaItem->pBuffer);
+        free(uaItem);
+        return S_db_badField;
+    }
+    if(uaItem->pollInterval > 0 && prec->scan != SCAN_IO_EVENT) {
+        recGblRecordError(S_db_badField, prec, "devOpcUa (init_record) option 'poll' needs SCAN=I/O Intr");
+        prec->dpvt = NULL;
+        epicsMutexDestroy(uaItem->flagLock);
+        free(uaItem->pBuffer);
+        free(uaItem);
+        return S_db_badField;
+    }
+    if(uaItem->pollInterval > 0 && !uaItem->ioScanGroup) {
+        char name[80];          /* the records of a poll group are scanned together */
+        sprintf(name, "opcua:poll:%d:%g:%g", uaItem->session, uaItem->pollInterval, uaItem->maxAge);
+        uaItem->ioscanpvt = getIoScanGroup(name);
+        uaItem->ioScanGroup = 1;
+    }
+    if(!inpType && !uaItem->ioScanGroup) {
         scanIoInit(&(uaItem->ioscanpvt));
     }
+    if(addOPCUA_Item(uaItem)) {
+        recGblRecordError(S_dev_noDevice, prec, "devOpcUa (init_record) no OpcUa session");
+        prec->dpvt = NULL;
+        epicsMutexDestroy(uaItem->flagLock);
+        free(uaItem->pBuffer);
+        free(uaItem);
+        return S_dev_noDevice;
+    }
     return 0;
 }
 
@@ -273,12 +536,12 @@ long init_common (dbCommon *prec, struct link* plnk, int recType, void *val, int
  **************************************************************************-*/
 long init_longin (struct longinRecord* prec)
 {
-    return init_common((dbCommon*)prec,&(prec->inp),epicsInt32T,(void*)&(prec->val),0,NULL);
+    return init_common((dbCommon*)prec,&(prec->inp),epicsInt32T,(void*)&(prec->val),0,NULL,0);
 }
 
 long read_longin (struct longinRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
     int flagSuppressWrite = uaItem->flagSuppressWrite;
     int udf   = prec->udf;
@@ -300,12 +563,12 @@ long read_longin (struct longinRecord* prec)
  ***************************************************************************/
 long init_longout( struct longoutRecord* prec)
 {
-    return init_common((dbCommon*)prec,&(prec->out),epicsInt32T,(void*)&(prec->val),epicsInt32T,(void*)&(prec->val));
+    return init_common((dbCommon*)prec,&(prec->out),epicsInt32T,(void*)&(prec->val),epicsInt32T,(void*)&(prec->val),0);
 }
 
 long write_longout (struct longoutRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     if(DEBUG_LEVEL >= 2) errlogPrintf("write_longout   %s %s RVAL:%d\n",prec->name,getTime(buf),prec->val);
     return write((dbCommon*)prec);
 }
@@ -316,12 +579,12 @@ long write_longout (struct longoutRecord* prec)
 long init_mbbiDirect (struct mbbiDirectRecord* prec)
 {
     prec->mask <<= prec->shft;
-    return init_common((dbCommon*)prec,&(prec->inp),epicsUInt32T,(void*)&(prec->rval),0,NULL);
+    return init_common((dbCommon*)prec,&(prec->inp),epicsUInt32T,(void*)&(prec->rval),0,NULL,0);
 }
 
 long read_mbbiDirect (struct mbbiDirectRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
     long ret;
     int flagSuppressWrite = uaItem->flagSuppressWrite;
@@ -343,12 +606,12 @@ long read_mbbiDirect (struct mbbiDirectRecord* prec)
  ***************************************************************************/
 long init_mbboDirect( struct mbboDirectRecord* prec)
 {
-    return init_common((dbCommon*)prec,&(prec->out),epicsUInt32T,(void*)&(prec->rval),epicsUInt32T,(void*)&(prec->val));
+    return init_common((dbCommon*)prec,&(prec->out),epicsUInt32T,(void*)&(prec->rval),epicsUInt32T,(void*)&(prec->val),0);
 }
 
 long write_mbboDirect (struct mbboDirectRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     prec->rval = prec->rval & prec->mask;
     if(DEBUG_LEVEL >= 2) errlogPrintf("write_mbboDirect %s %s RVAL:%d\n",prec->name,getTime(buf),prec->rval);
     return write((dbCommon*)prec);
@@ -359,12 +622,12 @@ long write_mbboDirect (struct mbboDirectRecord* prec)
 long init_mbbi (struct mbbiRecord* prec)
 {
     prec->mask <<= prec->shft;
-    return init_common((dbCommon*)prec,&(prec->inp),epicsUInt32T,(void*)&(prec->rval),0,NULL);
+    return init_common((dbCommon*)prec,&(prec->inp),epicsUInt32T,(void*)&(prec->rval),0,NULL,0);
 }
 
 long read_mbbi (struct mbbiRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
     long ret;
     int flagSuppressWrite = uaItem->flagSuppressWrite;
@@ -387,12 +650,12 @@ long read_mbbi (struct mbbiRecord* prec)
 long init_mbbo( struct mbboRecord* prec)
 {
     prec->mask <<= prec->shft;
-    return init_common((dbCommon*)prec,&(prec->out),epicsUInt32T,(void*)&(prec->rval),epicsUInt32T,(void*)&(prec->rval));
+    return init_common((dbCommon*)prec,&(prec->out),epicsUInt32T,(void*)&(prec->rval),epicsUInt32T,(void*)&(prec->rval),0);
 }
 
 long write_mbbo (struct mbboRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     prec->rval = prec->rval & prec->mask;
     if(DEBUG_LEVEL >= 2) errlogPrintf("write_mbbo      %s %s RVAL:%d\n",prec->name,getTime(buf),prec->rval);
     return write((dbCommon*)prec);
@@ -403,12 +666,12 @@ long write_mbbo (struct mbboRecord* prec)
  **************************************************************************-*/
 long init_bi (struct biRecord* prec)
 {
-    return init_common((dbCommon*)prec,&(prec->inp),epicsUInt32T,(void*)&(prec->rval),0,NULL);
+    return init_common((dbCommon*)prec,&(prec->inp),epicsUInt32T,(void*)&(prec->rval),0,NULL,0);
 }
 
 long read_bi (struct biRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
     int flagSuppressWrite = uaItem->flagSuppressWrite;
     int udf   = prec->udf;
@@ -432,12 +695,12 @@ long read_bi (struct biRecord* prec)
 long init_bo( struct boRecord* prec)
 {
     prec->mask=1;
-    return init_common((dbCommon*)prec,&(prec->out),epicsUInt32T,(void*)&(prec->rval),epicsUInt32T,(void*)&(prec->rval));
+    return init_common((dbCommon*)prec,&(prec->out),epicsUInt32T,(void*)&(prec->rval),epicsUInt32T,(void*)&(prec->rval),0);
 }
 
 long write_bo (struct boRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     if(DEBUG_LEVEL >= 2) errlogPrintf("write_bo        %s %s RVAL:%d\n",prec->name,getTime(buf),prec->rval);
     return write((dbCommon*)prec);
 }
@@ -449,9 +712,9 @@ long init_ao (struct aoRecord* prec)
 {
     long ret;
     if(prec->linr == menuConvertNO_CONVERSION)
-        ret = init_common((dbCommon*)prec,&(prec->out),epicsFloat64T,(void*)&(prec->oval),epicsFloat64T,(void*)&(prec->val));
+        ret = init_common((dbCommon*)prec,&(prec->out),epicsFloat64T,(void*)&(prec->oval),epicsFloat64T,(void*)&(prec->val),0);
     else
-        ret = init_common((dbCommon*)prec,&(prec->out),epicsInt32T,(void*)&(prec->rval),epicsFloat64T,(void*)&(prec->val));
+        ret = init_common((dbCommon*)prec,&(prec->out),epicsInt32T,(void*)&(prec->rval),epicsFloat64T,(void*)&(prec->val),0);
     if(DEBUG_LEVEL >= 2) {
         OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
         errlogPrintf("init_ao %s\t VAL %f RVAL %d OPCVal %f\n",prec->name,prec->val,prec->rval,(uaItem->varVal).Double);
@@ -461,7 +724,7 @@ long init_ao (struct aoRecord* prec)
 
 long write_ao (struct aoRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     if(DEBUG_LEVEL >= 2) {
         OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
         errlogPrintf("write_ao %s %s VAL %f RVAL %d OPCVal %f\n",prec->name,getTime(buf),prec->val,prec->rval,(uaItem->varVal).Double);
@@ -481,14 +744,14 @@ long write_ao (struct aoRecord* prec)
 long init_ai (struct aiRecord* prec)
 {
     if(prec->linr == menuConvertNO_CONVERSION)
-        return init_common((dbCommon*)prec,&(prec->inp),epicsFloat64T,(void*)&(prec->val),0,NULL);
+        return init_common((dbCommon*)prec,&(prec->inp),epicsFloat64T,(void*)&(prec->val),0,NULL,0);
     else
-        return init_common((dbCommon*)prec,&(prec->inp),epicsInt32T,(void*)&(prec->rval),0,NULL);
+        return init_common((dbCommon*)prec,&(prec->inp),epicsInt32T,(void*)&(prec->rval),0,NULL,0);
 }
 
 long read_ai (struct aiRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     double newVal;
     long ret;
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*) prec->dpvt;
@@ -526,12 +789,12 @@ long read_ai (struct aiRecord* prec)
  **************************************************************************-*/
 long init_stringin (struct stringinRecord* prec)
 {
-    return init_common((dbCommon*)prec,&(prec->inp),epicsOldStringT,(void*)&(prec->val),0,NULL);
+    return init_common((dbCommon*)prec,&(prec->inp),epicsOldStringT,(void*)&(prec->val),0,NULL,0);
 }
 
 long read_stringin (struct stringinRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
     int flagSuppressWrite = uaItem->flagSuppressWrite;
     int udf   = prec->udf;
@@ -554,12 +817,12 @@ long read_stringin (struct stringinRecord* prec)
  ***************************************************************************/
 long init_stringout( struct stringoutRecord* prec)
 {
-    return init_common((dbCommon*)prec,&(prec->out),epicsStringT,(void*)&(prec->val),epicsStringT,(void*)&(prec->val));
+    return init_common((dbCommon*)prec,&(prec->out),epicsStringT,(void*)&(prec->val),epicsStringT,(void*)&(prec->val),0);
 }
 
 long write_stringout (struct stringoutRecord* prec)
 {
-    char buf[256];
+    char buf[30];
     if(DEBUG_LEVEL >= 2) errlogPrintf("write_stringout %s %s VAL:%s\n",prec->name,getTime(buf),prec->val);
     return write((dbCommon*)prec);
 }
@@ -569,9 +832,7 @@ long write_stringout (struct stringoutRecord* prec)
  **************************************************************************-*/
 long init_waveformRecord(struct waveformRecord* prec)
 {
-    long ret = 0;
     int recType=0;
-    OPCUA_ItemINFO* pOpcUa2Epics=NULL;
     prec->dpvt = NULL;
     switch(prec->ftvl) {
         case menuFtypeSTRING: recType = epicsOldStringT; break;
@@ -585,18 +846,12 @@ long init_waveformRecord(struct waveformRecord* prec)
         case menuFtypeDOUBLE: recType = epicsFloat64T; break;
         case menuFtypeENUM  : recType = epicsEnum16T; break;
     }
-    ret = init_common((dbCommon*)prec,&(prec->inp),recType,(void*)prec->bptr,0,NULL);
-    pOpcUa2Epics = (OPCUA_ItemINFO*)prec->dpvt;
-    if(pOpcUa2Epics != NULL) {
-        pOpcUa2Epics->isArray = 1;
-        pOpcUa2Epics->arraySize = prec->nelm;
-    }
-    return  ret;
+    return init_common((dbCommon*)prec,&(prec->inp),recType,(void*)prec->bptr,0,NULL,prec->nelm);
 }
 
 long read_wf(struct waveformRecord *prec)
 {
-    char buf[256];
+    char buf[30];
     int udf   = prec->udf;
     int ret = 0;
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
@@ -606,8 +861,12 @@ long read_wf(struct waveformRecord *prec)
     epicsMutexLock(uaItem->flagLock);
     ret = read((dbCommon*)prec);
     if(! ret) {
-        prec->nord = uaItem->arraySize;
-        uaItem->arraySize = prec->nelm;
+        if(uaItem->buffered) {  /* hand over the samples collected since the last processing */
+            memcpy(prec->bptr, uaItem->pBuffer, uaItem->bufCount * dbValueSize(prec->ftvl));
+            uaItem->arrayCount = uaItem->bufCount;
+            uaItem->bufCount = 0;
+        }
+        prec->nord = uaItem->arrayCount;
         prec->udf=FALSE;
     }
     epicsMutexUnlock(uaItem->flagLock);
@@ -618,7 +877,7 @@ long read_wf(struct waveformRecord *prec)
 
 /* callback service routine */
 static void outRecordCallback(CALLBACK *pcallback) {
-    char buf[256];
+    char buf[30];
     dbCommon *prec;
     callbackGetUser(prec, pcallback);
     if(prec) {
@@ -627,6 +886,72 @@ static void outRecordCallback(CALLBACK *pcallback) {
     }
 }
 
+/* minwrite: the interval is over, process the record to write its latest value.
+ * setupWrite: the session is set up, write the value set before. Notifications don't
+ * overwrite it until the write is sent, see DevUaSubscription::processItem().
+ */
+static void deferredWriteCallback(CALLBACK *pcallback) {
+    dbCommon *prec;
+    callbackGetUser(prec, pcallback);
+    if(prec) {
+        OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
+        dbScanLock(prec);
+        epicsMutexLock(uaItem->flagLock);
+        uaItem->writeDeferred = 0;
+        epicsMutexUnlock(uaItem->flagLock);
+        dbProcess(prec);
+        epicsMutexLock(uaItem->flagLock);
+        uaItem->setupWrite = 0;
+        epicsMutexUnlock(uaItem->flagLock);
+        dbScanUnlock(prec);
+    }
+}
+
+/* The records value to be written as double, return 1 if it isn't numeric */
+static int getNumericVal(OPCUA_ItemINFO* uaItem, double *pVal) {
+    switch(uaItem->recDataType) {
+    case epicsInt32T:   *pVal = *(epicsInt32 *) uaItem->pRecVal; return 0;
+    case epicsUInt32T:  *pVal = *(epicsUInt32 *) uaItem->pRecVal; return 0;
+    case epicsFloat64T: *pVal = *(epicsFloat64 *) uaItem->pRecVal; return 0;
+    default:            return 1;
+    }
+}
+
+/* Client side output filter, return 1 if the write is suppressed:
+ * odeadband: the value differs by <= outDeadband from the last written or read back value
+ * minwrite:  the last write is less than minWriteInterval ago. The record is processed again
+ *            when the interval is over, so the latest value is written.
+ */
+static int writeSuppressed(OPCUA_ItemINFO* uaItem) {
+    epicsTimeStamp now;
+    double val = 0.0;
+    int numeric;
+
+    if(uaItem->outDeadband < 0 && uaItem->minWriteInterval <= 0)
+        return 0;
+    numeric = !getNumericVal(uaItem, &val);
+    if(numeric && uaItem->lastWriteValid && uaItem->outDeadband >= 0 && fabs(val - uaItem->lastWriteVal) <= uaItem->outDeadband) {
+        uaItem->writesSuppressed++;
+        return 1;
+    }
+    epicsTimeGetCurrent(&now);
+    if(uaItem->lastWriteValid && uaItem->minWriteInterval > 0) {
+        double dt = epicsTimeDiffInSeconds(&now, &uaItem->lastWriteTime);
+        if(dt >= 0 && dt < uaItem->minWriteInterval) {
+            if(!uaItem->writeDeferred) {
+                uaItem->writeDeferred = 1;
+                callbackRequestDelayed(&(uaItem->deferCallback), uaItem->minWriteInterval - dt);
+            }
+            uaItem->writesDeferred++;
+            return 1;
+        }
+    }
+    uaItem->lastWriteValid = 1;
+    uaItem->lastWriteVal = val;
+    uaItem->lastWriteTime = now;
+    return 0;
+}
+
 static long get_ioint_info(int cmd, dbCommon *prec, IOSCANPVT * ppvt) {
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
     if(!prec || !prec->dpvt)
@@ -658,31 +983,87 @@ static long read(dbCommon * prec) {
     }
     else {
         prec->udf=FALSE;
+        if(uaItem->isArray)
+            TRACE(uaItem,traceRead,epicsInt32T,&uaItem->arrayCount);
+        else
+            TRACE(uaItem,traceRead,uaItem->recDataType,&uaItem->varVal);
     }
     return ret;
 }
 
+/* Asynchronous: the first call starts the write and sets PACT. writeComplete() processes the record
+ * again with PACT set, then the alarm of the write is set.
+ * write=latest: the record doesn't wait, it gets the alarm of the last completed write.
+ */
 static long write(dbCommon *prec) {
     long ret = 0;
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
     uaItem->debug = prec->tpro;
     
-    if(DEBUG_LEVEL >= 3) errlogPrintf("\twrite()            UDF:%i, flagSuppressWrite=%i\n",prec->udf,uaItem->flagSuppressWrite);
+    if(DEBUG_LEVEL >= 3) errlogPrintf("\twrite()            UDF:%i, flagSuppressWrite=%i PACT=%i\n",prec->udf,uaItem->flagSuppressWrite,prec->pact);
 
     if(!uaItem) {
         if(DEBUG_LEVEL > 0) errlogPrintf("\twrite %s\t error\n", prec->name);
         ret = -1;
     }
+    else if(prec->pact) {
+        if(uaItem->writeSevr) {
+            TRACE(uaItem,traceWriteFailed,uaItem->recDataType,uaItem->pRecVal);
+            recGblSetSevr(prec,uaItem->writeStat,uaItem->writeSevr);
+            if(uaItem->writeSevr == menuAlarmSevrINVALID)
+                return -1;
+        }
+        prec->udf=FALSE;
+        return 0;
+    }
     else {
         epicsMutexLock(uaItem->flagLock);
         if(uaItem->flagSuppressWrite == 1) {
                 uaItem->flagSuppressWrite = 0;
+                /* odeadband: the value of the server changed, e.g. set by the readback.
+                 * Compare the next write to the servers value, not to the last written one */
+                if(uaItem->lastWriteValid)
+                    getNumericVal(uaItem, &uaItem->lastWriteVal);
+                /* processed by the connection loss or a bad readback: no valid value */
+                if(uaItem->stat) {
+                    epicsMutexUnlock(uaItem->flagLock);
+                    recGblSetSevr(prec,menuAlarmStatCOMM,menuAlarmSevrINVALID);
+                    return 0;
+                }
                 epicsMutexUnlock(uaItem->flagLock);
         }
+        else if(writeSuppressed(uaItem)) {
+            epicsMutexUnlock(uaItem->flagLock);
+            if(DEBUG_LEVEL >= 2) errlogPrintf("\twrite %s\t suppressed by odeadband/minwrite\n", prec->name);
+        }
         else {
-            uaItem->flagSuppressWrite = 1;
             epicsMutexUnlock(uaItem->flagLock);
+            TRACE(uaItem,traceWrite,uaItem->recDataType,uaItem->pRecVal);
+            if(!uaItem->coalesce)
+                prec->pact = TRUE;
             ret = OpcUaWriteItems(uaItem);
+            if(ret == OPCUA_WRITE_DEFERRED) {
+                /* PINI or autosave before the background setup: not written yet, written
+                 * by deferCallback when the session is set up */
+                prec->pact = FALSE;
+                epicsMutexLock(uaItem->flagLock);
+                uaItem->lastWriteValid = 0;
+                epicsMutexUnlock(uaItem->flagLock);
+                if(DEBUG_LEVEL >= 2) errlogPrintf("\twrite %s\t deferred until the session is set up\n", prec->name);
+                recGblSetSevr(prec,menuAlarmStatCOMM,menuAlarmSevrINVALID);
+                return 0;
+            }
+            if(ret) {
+                prec->pact = FALSE;
+                TRACE(uaItem,traceWriteFailed,uaItem->recDataType,uaItem->pRecVal);
+            }
+            else if(!uaItem->coalesce)
+                return 0;
+        }
+        if(!ret && uaItem->coalesce && uaItem->writeSevr) {
+            recGblSetSevr(prec,uaItem->writeStat,uaItem->writeSevr);
+            if(uaItem->writeSevr == menuAlarmSevrINVALID)
+                ret = -1;
         }
     }
     if(DEBUG_LEVEL >= 3) errlogPrintf("\tOpcUaWriteItems() Done set flagSuppressWrite=%i\n",uaItem->flagSuppressWrite);
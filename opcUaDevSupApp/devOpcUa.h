@@ -22,6 +22,7 @@
 #include <callback.h>
 #include <epicsTypes.h>
 #include <epicsMutex.h>
+#include <epicsTime.h>
 
 #define ANY_VAL_STRING_SIZE 80
 typedef union {                     /* A subset of the built in types we use */
@@ -32,13 +33,40 @@ typedef union {                     /* A subset of the built in types we use */
         char         cString[ANY_VAL_STRING_SIZE];   /* find max defined stringsize of base: */
 } epicsAnyVal;                      // perl -ne 'print "$2 $1\n" if($_=~/char\s+([\w\d_]+)\[(\d+)\]/);' base-3.14.12.5/include/*|sort -u
 
+/* Conversion plans, set up once the data type of the server is known.
+ * readConv:  OPC scalar of type itemDataType -> records data type, used by setRecVal
+ * writeConv: records value -> OPC scalar of exactly the type itemDataType
+ */
+struct _OpcUa_Variant;
+typedef long (*OPCUA_ReadConv)(const struct _OpcUa_Variant *pVariant, void *toRec);
+typedef long (*OPCUA_WriteConv)(const void *fromRec, struct _OpcUa_Variant *pVariant);
+
 #define ITEMPATHLEN 128
+#define DEFAULT_SAMPLING_INTERVAL 100.0
+#define DEFAULT_QUEUE_SIZE        1
+#define QUEUE_NOT_SET             0     /* no link option queue: DEFAULT_QUEUE_SIZE, NELM for buffer= */
+
+/* DataChangeFilter, values as OpcUa_DataChangeTrigger and OpcUa_DeadbandType.
+ * FILTER_DEFAULT: use the setting of the subscription group */
+#define FILTER_DEFAULT              -1
+#define TRIGGER_STATUS              0
+#define TRIGGER_STATUSVALUE         1
+#define TRIGGER_STATUSVALUETIMESTAMP 2
+#define DEADBAND_NONE               0
+#define DEADBAND_ABSOLUTE           1
+#define DEADBAND_PERCENT            2
+
+/* Buffered waveforms */
+#define BUFFER_VALUE    1
+#define BUFFER_TIME     2   /* timestamps as seconds since 1970, FTVL=DOUBLE */
 typedef struct OPCUA_Item {
 
 //    int NdIdx;              // Namspace index
     char ItemPath[ITEMPATHLEN];
 
     int itemDataType;       /* OPCUA Datatype */
+    OPCUA_ReadConv  readConv;   /* NULL: use generic conversion */
+    OPCUA_WriteConv writeConv;  /* NULL: no conversion known, can't write */
     int itemIdx;            /* Index of this item in UaNodeId vector */
 
     epicsAnyVal varVal;     /* buffer to hold the value got from Opc for all scalar values, including string   */
@@ -52,14 +80,55 @@ typedef struct OPCUA_Item {
     epicsMutexId flagLock;  /* mutex for lock flag access */
 
     int isArray;
-    int arraySize;
+    int arraySize;          /* waveform: NELM, max. number of elements */
+    int arrayCount;         /* waveform: number of elements of the last update */
+    int buffered;           /* waveform of a scalar node: BUFFER_VALUE or BUFFER_TIME, collect all samples */
+    void *pBuffer;          /* buffered: samples received since the last record processing */
+    int bufCount;
+    unsigned long bufOverflows;
+
+    int session;            /* index of the session, 0: the first drvOpcuaSetup() */
+    int subscription;       /* index of the subscription group, 0: default */
+    double samplingInterval;    /* monitored item parameters [ms] */
+    int queueSize;          /* QUEUE_NOT_SET until init_common() is done */
+    int discardOldest;
+    int trigger;            /* DataChangeFilter trigger or FILTER_DEFAULT */
+    int deadbandType;       /* DataChangeFilter deadband type or FILTER_DEFAULT */
+    double deadband;
+    double pollInterval;    /* IN records: read by a poll group every pollInterval [sec], 0: monitored */
+    double maxAge;          /* pollInterval: maxAge of the read [ms], 0: read from the device */
 
+    int tsSource;           /* TSE=-2: 1 use the source timestamp, 0 the server timestamp */
     int debug;              // debug level of this item, defined in field REC:TPRO
+    int trace;              /* write binary trace entries, see devUaTrace.h */
     int stat;               /* Status of the opc connection */
+    int connLost;           /* stat was set by a connection loss, see DevUaSubscription::restoreItems() */
     int flagSuppressWrite;  /* flag for OUT-records: prevent write back of incomming values */
+    int echoPending;        /* OUT-records: writes sent whose dataChange (echo) didn't arrive yet */
+    int echoNumeric;        /* echoVal is set: */
+    double echoVal;         /* the value of the last write sent, its echo is the last one */
 
     IOSCANPVT ioscanpvt;    /* in-records scan request.*/
+    int ioScanGroup;        /* in-records: ioscanpvt is shared by the records of an I/O scan group */
     CALLBACK callback;      /* out-records callback request.*/
+    CALLBACK writeCallback; /* out-records: complete the asynchronous write */
+    int writeStat;          /* out-records: alarm of the last completed write, set by writeComplete() */
+    int writeSevr;
+    int coalesce;           /* out-records: link option write=latest, don't wait for the write, see queueWrite() */
+    int writeInFlight;      /* coalesce: a write of this item is sent */
+    int writePending;       /* coalesce: pendingVal is sent when the write in flight completes */
+    epicsAnyVal pendingVal;
+    unsigned long writesCoalesced;  /* coalesce: pending values replaced by a newer one */
+    double outDeadband;     /* out-records: don't write changes <= outDeadband, <0: off */
+    double minWriteInterval;    /* out-records: min. time between writes [sec], 0: off */
+    int lastWriteValid;
+    double lastWriteVal;
+    epicsTimeStamp lastWriteTime;
+    int writeDeferred;      /* minWriteInterval or setupWrite: deferCallback is scheduled */
+    CALLBACK deferCallback; /* minWriteInterval: process the record when the interval is over */
+    int setupWrite;         /* processed before its session was set up: deferCallback writes the value */
+    unsigned long writesSuppressed; /* writes suppressed by outDeadband */
+    unsigned long writesDeferred;   /* writes deferred by minWriteInterval */
 
     dbCommon *prec;
 } OPCUA_ItemINFO;
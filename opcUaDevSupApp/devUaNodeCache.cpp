@@ -0,0 +1,230 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+
+#include "uabase.h"
+#include <errlog.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+
+#include "devUaNodeCache.h"
+
+/* Entries of one server, the key of the map is the item path as in the link */
+typedef struct {
+    std::vector<std::string> namespaces;
+    std::map<std::string, std::string> nodes;    // NodeId as xml string "ns=2;s=..."
+} NodeCacheServer;
+
+static std::string nodeCacheFile;
+static std::map<std::string, NodeCacheServer> nodeCache;    // key: server URL
+static bool nodeCacheDirty = false;
+static unsigned long nodeCacheHits = 0;
+static unsigned long nodeCacheMisses = 0;
+static unsigned long nodeCacheDropped = 0;
+
+static epicsThreadOnceId nodeCacheOnce = EPICS_THREAD_ONCE_INIT;
+static epicsMutexId nodeCacheLock;
+
+static void nodeCacheInit(void *)
+{
+    nodeCacheLock = epicsMutexMustCreate();
+}
+
+/* Split a line of the file in fields separated by tabs, the last field takes the rest */
+static bool splitLine(const std::string &line, std::string *fields, int n)
+{
+    std::string::size_type pos = 0;
+    for(int i=0; i<n-1; i++) {
+        std::string::size_type tab = line.find('\t', pos);
+        if(tab == std::string::npos)
+            return false;
+        fields[i] = line.substr(pos, tab-pos);
+        pos = tab + 1;
+    }
+    fields[n-1] = line.substr(pos);
+    return true;
+}
+
+/* iocShell: set the cache file and load it, a missing file is created by the first save */
+int nodeCacheSetFile(const char *fileName)
+{
+    epicsThreadOnce(&nodeCacheOnce, nodeCacheInit, NULL);
+    epicsMutexLock(nodeCacheLock);
+    nodeCacheFile = fileName ? fileName : "";
+    nodeCache.clear();
+    nodeCacheDirty = false;
+
+    std::ifstream in(nodeCacheFile.c_str());
+    std::string line;
+    unsigned int n = 0, bad = 0;
+    while(in.good() && std::getline(in, line)) {
+        std::string f[4];
+        if(line.empty() || line[0] == '#')
+            continue;
+        if(!splitLine(line, f, 4)) {
+            bad++;
+            continue;
+        }
+        if(f[0] == "ns") {
+            std::vector<std::string> &ns = nodeCache[f[1]].namespaces;
+            unsigned int idx = strtoul(f[2].c_str(), NULL, 10);
+            if(ns.size() <= idx)
+                ns.resize(idx+1);
+            ns[idx] = f[3];
+        }
+        else if(f[0] == "node") {
+            nodeCache[f[1]].nodes[f[2]] = f[3];
+            n++;
+        }
+        else
+            bad++;
+    }
+    epicsMutexUnlock(nodeCacheLock);
+    if(bad)
+        errlogPrintf("opcuaNodeCache: %u illegal lines in '%s' ignored\n", bad, nodeCacheFile.c_str());
+    errlogPrintf("opcuaNodeCache: %u nodes loaded from '%s'\n", n, nodeCacheFile.c_str());
+    return 0;
+}
+
+bool nodeCacheEnabled()
+{
+    return !nodeCacheFile.empty();
+}
+
+/* Drop the entries of the server if the indexes of its namespaces changed, the browse paths
+ * use the indexes. Store the current namespace table.
+ */
+void nodeCacheCheckNamespaces(const std::string &server, const UaStringArray &namespaces)
+{
+    std::vector<std::string> current;
+    for(OpcUa_UInt32 i=0; i<namespaces.length(); i++)
+        current.push_back(UaString(&namespaces[i]).toUtf8());
+    if(current.empty())     // not known, keep what we have
+        return;
+
+    epicsMutexLock(nodeCacheLock);
+    NodeCacheServer &entry = nodeCache[server];
+    if(entry.namespaces != current) {
+        if(!entry.nodes.empty()) {
+            errlogPrintf("opcuaNodeCache: NamespaceArray of '%s' changed, drop %u cached nodes\n",
+                         server.c_str(), (unsigned int) entry.nodes.size());
+            nodeCacheDropped += entry.nodes.size();
+            entry.nodes.clear();
+        }
+        entry.namespaces = current;
+        nodeCacheDirty = true;
+    }
+    epicsMutexUnlock(nodeCacheLock);
+}
+
+bool nodeCacheGet(const std::string &server, const std::string &path, UaNodeId &node)
+{
+    bool found = false;
+    epicsMutexLock(nodeCacheLock);
+    std::map<std::string, NodeCacheServer>::iterator it = nodeCache.find(server);
+    if(it != nodeCache.end()) {
+        std::map<std::string, std::string>::iterator n = it->second.nodes.find(path);
+        if(n != it->second.nodes.end()) {
+            node = UaNodeId::fromXmlString(UaString(n->second.c_str()));
+            found = !node.isNull();
+        }
+    }
+    if(found)
+        nodeCacheHits++;
+    else
+        nodeCacheMisses++;
+    epicsMutexUnlock(nodeCacheLock);
+    return found;
+}
+
+void nodeCachePut(const std::string &server, const std::string &path, const UaNodeId &node)
+{
+    std::string id = node.toXmlString().toUtf8();
+    epicsMutexLock(nodeCacheLock);
+    std::string &entry = nodeCache[server].nodes[path];
+    if(entry != id) {
+        entry = id;
+        nodeCacheDirty = true;
+    }
+    epicsMutexUnlock(nodeCacheLock);
+}
+
+/* The server doesn't know the cached node any more (BadNodeIdUnknown) */
+void nodeCacheRemove(const std::string &server, const std::string &path)
+{
+    epicsMutexLock(nodeCacheLock);
+    std::map<std::string, NodeCacheServer>::iterator it = nodeCache.find(server);
+    if(it != nodeCache.end() && it->second.nodes.erase(path)) {
+        nodeCacheDropped++;
+        nodeCacheDirty = true;
+    }
+    epicsMutexUnlock(nodeCacheLock);
+}
+
+/* Write the cache if it changed. Write to a temporary file first, a crash never leaves a
+ * truncated cache.
+ */
+void nodeCacheSave()
+{
+    if(!nodeCacheEnabled())
+        return;
+    epicsMutexLock(nodeCacheLock);
+    if(!nodeCacheDirty) {
+        epicsMutexUnlock(nodeCacheLock);
+        return;
+    }
+    std::string tmpFile = nodeCacheFile + ".tmp";
+    std::ofstream out(tmpFile.c_str());
+    out << "# opcUa node cache: ns <server> <index> <uri> | node <server> <path> <NodeId>\n";
+    for(std::map<std::string, NodeCacheServer>::iterator it = nodeCache.begin(); it != nodeCache.end(); ++it) {
+        for(unsigned int i=0; i<it->second.namespaces.size(); i++)
+            out << "ns\t" << it->first << '\t' << i << '\t' << it->second.namespaces[i] << '\n';
+        for(std::map<std::string, std::string>::iterator n = it->second.nodes.begin(); n != it->second.nodes.end(); ++n)
+            out << "node\t" << it->first << '\t' << n->first << '\t' << n->second << '\n';
+    }
+    out.close();
+    bool ok = !out.fail();
+    if(ok && rename(tmpFile.c_str(), nodeCacheFile.c_str())) {
+        remove(nodeCacheFile.c_str());      // WIN32: rename doesn't replace
+        ok = !rename(tmpFile.c_str(), nodeCacheFile.c_str());
+    }
+    if(ok)
+        nodeCacheDirty = false;
+    epicsMutexUnlock(nodeCacheLock);
+    if(!ok)
+        errlogPrintf("opcuaNodeCache: can't write '%s'\n", nodeCacheFile.c_str());
+}
+
+void nodeCacheReport()
+{
+    if(!nodeCacheEnabled())
+        return;
+    epicsMutexLock(nodeCacheLock);
+    unsigned long n = 0;
+    for(std::map<std::string, NodeCacheServer>::iterator it = nodeCache.begin(); it != nodeCache.end(); ++it)
+        n += it->second.nodes.size();
+    errlogPrintf("Node cache '%s': %lu nodes, %lu hits, %lu misses, %lu dropped\n",
+                 nodeCacheFile.c_str(), n, nodeCacheHits, nodeCacheMisses, nodeCacheDropped);
+    epicsMutexUnlock(nodeCacheLock);
+}
@@ -0,0 +1,39 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef INCdevUaNodeCacheH
+#define INCdevUaNodeCacheH
+
+#include <string>
+
+#include "uabase.h"
+
+/* Persistent cache of translated browse paths: server URL + item path -> NodeId.
+ * The file set by opcuaNodeCache() is loaded at once and written back by nodeCacheSave()
+ * when entries changed. The namespace table of each server is stored with its entries,
+ * they are dropped if the server's NamespaceArray differs.
+ */
+extern int  nodeCacheSetFile(const char *fileName);
+extern bool nodeCacheEnabled();
+extern void nodeCacheCheckNamespaces(const std::string &server, const UaStringArray &namespaces);
+extern bool nodeCacheGet(const std::string &server, const std::string &path, UaNodeId &node);
+extern void nodeCachePut(const std::string &server, const std::string &path, const UaNodeId &node);
+extern void nodeCacheRemove(const std::string &server, const std::string &path);
+extern void nodeCacheSave();
+extern void nodeCacheReport();
+
+#endif
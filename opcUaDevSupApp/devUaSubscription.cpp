@@ -16,23 +16,86 @@
 *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 \*************************************************************************/
 
+#include <algorithm>
+#include <map>
 #include "uasubscription.h"
 #include "uasession.h"
 #include <epicsTypes.h>
 #include <epicsPrint.h>
 #include <epicsTime.h>
+#include <epicsExport.h>
 #include "dbScan.h"
 #include "devOpcUa.h"
 #include "drvOpcUa.h"
+#include "devUaTrace.h"
 #include "devUaSubscription.h"
 
-DevUaSubscription::DevUaSubscription(int debug=0)
+/* Size of the dataChange handoff queue. 0: convert and process records within
+ * the SDK callback. >0: dataChange() just copies the notifications to a queue of
+ * this size that is handled by a separate consumer thread per subscription.
+ */
+static int dataChangeQueueSize = 0;
+extern "C" {
+    epicsExportAddress(int, dataChangeQueueSize);
+}
+
+DevUaSubscription::DevUaSubscription(int debug, OpcUa_UInt32 handle, const DevUaSubscriptionGroup &group)
     : debug(debug)
-{}
+    , m_pSession(NULL)
+    , m_pSubscription(NULL)
+    , m_handle(handle)
+    , m_name(group.name)
+    , m_settings(group.settings)
+    , m_trigger(group.trigger)
+    , m_deadbandType(group.deadbandType)
+    , m_deadband(group.deadband)
+    , m_monitoredItems(0)
+    , m_monitoredRecords(0)
+    , m_timestampsToReturn(OpcUa_TimestampsToReturn_Neither)
+    , m_lost(false)
+    , m_queueSize(dataChangeQueueSize)
+    , m_queueEntries(NULL)
+    , m_queueFree(NULL)
+    , m_queueData(NULL)
+    , m_queueEvent(NULL)
+    , m_queueExit(NULL)
+    , m_queueRun(0)
+    , m_queueOverflows(0)
+{
+    m_chainLock = epicsMutexMustCreate();
+    if(m_queueSize > 0) {
+        m_queueEntries = new DevUaQueueEntry[m_queueSize];
+        m_queueFree  = epicsRingPointerCreate(m_queueSize);
+        m_queueData  = epicsRingPointerCreate(m_queueSize);
+        m_queueEvent = epicsEventMustCreate(epicsEventEmpty);
+        m_queueExit  = epicsEventMustCreate(epicsEventEmpty);
+        for(int i=0; i<m_queueSize; i++) {
+            OpcUa_DataValue_Initialize(&m_queueEntries[i].value);
+            epicsRingPointerPush(m_queueFree, &m_queueEntries[i]);
+        }
+        m_queueRun = 1;
+        epicsThreadMustCreate("opcUaDataChange", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              queueConsumer, this);
+    }
+}
 
 DevUaSubscription::~DevUaSubscription()
 {
     deleteSubscription();
+    if(m_queueSize > 0) {
+        m_queueRun = 0;
+        epicsEventSignal(m_queueEvent);
+        epicsEventMustWait(m_queueExit);
+        for(int i=0; i<m_queueSize; i++)
+            OpcUa_DataValue_Clear(&m_queueEntries[i].value);
+        delete[] m_queueEntries;
+        epicsRingPointerDelete(m_queueFree);
+        epicsRingPointerDelete(m_queueData);
+        epicsEventDestroy(m_queueEvent);
+        epicsEventDestroy(m_queueExit);
+    }
+    epicsMutexDestroy(m_chainLock);
 }
 
 void DevUaSubscription::subscriptionStatusChanged(
@@ -40,7 +103,10 @@ void DevUaSubscription::subscriptionStatusChanged(
     const UaStatus&   status)
 {
     OpcUa_ReferenceParameter(clientSubscriptionHandle); // We use the callback only for this subscription
-    errlogPrintf("DevUaSubscription: subscription no longer valid - failed with status %d (%s)\n",
+    if(status.isBad())
+        m_lost = true;      // created again on the next Connected, see DevUaClient::recoverSubscriptions()
+    errlogPrintf("DevUaSubscription: subscription '%s' no longer valid - failed with status %d (%s)\n",
+                 m_name.c_str(),
                  status.statusCode(),
                  status.toString().toUtf8());
 }
@@ -53,78 +119,192 @@ void DevUaSubscription::dataChange(
     OpcUa_ReferenceParameter(clientSubscriptionHandle); // We use the callback only for this subscription
     OpcUa_ReferenceParameter(diagnosticInfos);
     OpcUa_UInt32 i = 0;
-    char timeBuf[30];
-    getTime(timeBuf);
-    if(debug>2) errlogPrintf("dataChange %s\n",timeBuf);
+
+    if(m_queueSize > 0) {   // just hand over to the consumer thread
+        for ( i=0; i<dataNotifications.length(); i++ )
+            queueDataValue(dataNotifications[i].ClientHandle, dataNotifications[i].Value);
+        epicsEventSignal(m_queueEvent);
+        return;
+    }
+
+    if(debug>2) {
+        char timeBuf[30];
+        errlogPrintf("dataChange %s\n",getTime(timeBuf));
+    }
     for ( i=0; i<dataNotifications.length(); i++ )
-    {
-        struct dataChangeError {};
-        OPCUA_ItemINFO* uaItem = m_vectorUaItemInfo->at(dataNotifications[i].ClientHandle);
-        if(debug>3)
-            errlogPrintf("\t%s\n",uaItem->prec->name);
-        else if(uaItem->debug >= 2)
-            errlogPrintf("dataChange: %s %s\n",timeBuf,uaItem->prec->name);
-        epicsMutexLock(uaItem->flagLock);
-        try {
-            if (OpcUa_IsBad(dataNotifications[i].Value.StatusCode) )
-            {
-                if(debug) errlogPrintf("%s %s dataChange FAILED with status %s, Handle=%d\n",timeBuf,uaItem->prec->name,
-                       UaStatus(dataNotifications[i].Value.StatusCode).toString().toUtf8(),dataNotifications[i].ClientHandle);
+        processDataValue(dataNotifications[i].ClientHandle, dataNotifications[i].Value);
+    requestIoScanGroups();
+    return;
+}
+
+/* Producer side of the handoff queue: copy the raw value, no conversion, no locks */
+void DevUaSubscription::queueDataValue(OpcUa_UInt32 clientHandle, const OpcUa_DataValue &value)
+{
+    DevUaQueueEntry *pEntry = (DevUaQueueEntry *) epicsRingPointerPop(m_queueFree);
+    if(!pEntry) {
+        m_queueOverflows++;
+        return;
+    }
+    pEntry->clientHandle = clientHandle;
+    OpcUa_DataValue_CopyTo(&value, &pEntry->value);
+    epicsRingPointerPush(m_queueData, pEntry);
+}
+
+/* Consumer side of the handoff queue: convert values and process the records */
+void DevUaSubscription::drainQueue()
+{
+    DevUaQueueEntry *pEntry;
+    if(debug>2) {
+        char timeBuf[30];
+        errlogPrintf("dataChange %s queued:%d\n",getTime(timeBuf),epicsRingPointerGetUsed(m_queueData));
+    }
+    while((pEntry = (DevUaQueueEntry *) epicsRingPointerPop(m_queueData)) != NULL) {
+        processDataValue(pEntry->clientHandle, pEntry->value);
+        OpcUa_DataValue_Clear(&pEntry->value);
+        epicsRingPointerPush(m_queueFree, pEntry);
+    }
+    requestIoScanGroups();
+}
+
+/* Scan each I/O scan group touched by the last update once, after all its values are set */
+void DevUaSubscription::requestIoScanGroups()
+{
+    for(std::vector<IOSCANPVT>::iterator it = m_ioScanGroups.begin(); it != m_ioScanGroups.end(); ++it)
+        scanIoRequest(*it);
+    m_ioScanGroups.clear();
+}
+
+void DevUaSubscription::queueConsumer(void *pSubscription)
+{
+    DevUaSubscription *pSub = (DevUaSubscription *) pSubscription;
+    while(pSub->m_queueRun) {
+        epicsEventMustWait(pSub->m_queueEvent);
+        pSub->drainQueue();
+    }
+    epicsEventSignal(pSub->m_queueExit);
+}
+
+void DevUaSubscription::queueStat()
+{
+    errlogPrintf("Subscription %u '%s': publishing interval %g ms, priority %u\n",
+                 m_handle, m_name.c_str(), m_settings.publishingInterval, m_settings.priority);
+    if(m_queueSize > 0)
+        errlogPrintf("  dataChange queue: size %d, used %d, overflows %lu\n",
+                     m_queueSize, epicsRingPointerGetUsed(m_queueData), m_queueOverflows);
+    errlogPrintf("  %u monitored items for %u records\n", m_monitoredItems, m_monitoredRecords);
+}
+
+/* One notification: the monitored item may be shared by several records, see createMonitoredItems() */
+void DevUaSubscription::processDataValue(OpcUa_UInt32 clientHandle, const OpcUa_DataValue &value)
+{
+    epicsMutexLock(m_chainLock);
+    for(OpcUa_UInt32 idx = clientHandle; idx != NO_ITEM; idx = idx < m_vNextItem.size() ? m_vNextItem[idx] : NO_ITEM)
+        processItem(m_vectorUaItemInfo->at(idx), idx, value);
+    epicsMutexUnlock(m_chainLock);
+}
+
+/* Set record data and trigger the processing for one record.
+ * The time string is for debug messages only, don't get it on the normal path.
+ */
+void DevUaSubscription::processItem(OPCUA_ItemINFO* uaItem, OpcUa_UInt32 clientHandle, const OpcUa_DataValue &value)
+{
+    struct dataChangeError {};
+    char timeBuf[30];
+    if(debug || uaItem->debug >= 2)
+        getTime(timeBuf);
+    if(debug>3)
+        errlogPrintf("\t%s\n",uaItem->prec->name);
+    else if(uaItem->debug >= 2)
+        errlogPrintf("dataChange: %s %s\n",timeBuf,uaItem->prec->name);
+    epicsMutexLock(uaItem->flagLock);
+    uaItem->connLost = 0;
+    try {
+        if (OpcUa_IsBad(value.StatusCode) )
+        {
+            TRACE(uaItem,traceBadStatus,0,&value.StatusCode);
+            if(debug) errlogPrintf("%s %s dataChange FAILED with status %s, Handle=%d\n",timeBuf,uaItem->prec->name,
+                   UaStatus(value.StatusCode).toString().toUtf8(),clientHandle);
+            throw dataChangeError();
+        }
+        uaItem->stat = 0;
+        TRACE(uaItem,traceDataChange,value.Value.Datatype | (value.Value.ArrayType ? TRACE_ARRAY : 0),&value.Value.Value);
+        /* OUT Record: the dataChange after a write of the record (echo). The server may report two
+         * writes within one sampling interval by one dataChange, the value of the last write ends them.
+         * The echo of an older write, while a newer one is on its way, doesn't set the value. */
+        bool echo = false;
+        bool olderEcho = false;
+        if(uaItem->inpDataType && uaItem->echoPending > 0) {
+            OpcUa_Double d;
+            echo = true;
+            if(uaItem->echoNumeric && value.Value.ArrayType == OpcUa_VariantArrayType_Scalar
+               && UaVariant(value.Value).toDouble(d) == OpcUa_Good && d == uaItem->echoVal)
+                uaItem->echoPending = 0;
+            else
+                uaItem->echoPending--;
+            olderEcho = (uaItem->echoPending > 0);
+        }
+        if(uaItem->buffered) {
+            if(appendSample(value,uaItem)) {
+                if(debug) errlogPrintf("%s %s dataChange FAILED: appendSample()\n",timeBuf,uaItem->prec->name);
                 throw dataChangeError();
             }
-            uaItem->stat = 0;
-            UaVariant val = dataNotifications[i].Value.Value;
-            if(setRecVal(val,uaItem,maxDebug(debug,uaItem->debug))) {
-                if(debug) errlogPrintf("%s %s dataChange FAILED: setRecVal()\n",timeBuf,uaItem->prec->name);
-                throw dataChangeError();
+        }
+        else if(!olderEcho && !uaItem->setupWrite && setRecVal(value.Value,uaItem,maxDebug(debug,uaItem->debug))) {
+            if(debug) errlogPrintf("%s %s dataChange FAILED: setRecVal()\n",timeBuf,uaItem->prec->name);
+            throw dataChangeError();
+        }
+        if(uaItem->inpDataType) { // is OUT Record
+            if(uaItem->debug >= 2) errlogPrintf("dataChange %s\tOUT rec flagSuppressWrite:%d echoPending:%d\n", uaItem->prec->name,uaItem->flagSuppressWrite,uaItem->echoPending);
+            if(echo) {
+                // Means dataChange after write operation of the record. Ignore this, no callback
             }
-            if(uaItem->inpDataType) { // is OUT Record
-                if(uaItem->debug >= 2) errlogPrintf("dataChange %s\tOUT rec flagSuppressWrite:%d\n", uaItem->prec->name,uaItem->flagSuppressWrite);
-                if(uaItem->flagSuppressWrite==0) {     // Means: dataChange by external value change. Set Record! Invoke processing by callback but suppress another write operation
-                    uaItem->flagSuppressWrite = 1;
-                    callbackRequest(&(uaItem->callback)); // out-records are SCAN="passive" so scanIoRequest doesn't work
-                }
-                else {  // Means dataChange after write operation of the record. Ignore this, no callback, suppress another processing of the record
-                    uaItem->flagSuppressWrite=0;
-                }
+            else if(uaItem->setupWrite) {
+                // The value set before the setup is written, see DevUaClient::setMonitorsUp()
             }
-            else { // is IN Record
-                if(uaItem->prec->scan == SCAN_IO_EVENT)
-                {
-                    scanIoRequest( uaItem->ioscanpvt );    // Update the record immediatly, for scan>SCAN_IO_EVENT update by periodic scan.
-                }
-
+            else if(uaItem->flagSuppressWrite==0) {     // Means: dataChange by external value change. Set Record! Invoke processing by callback but suppress another write operation
+                uaItem->flagSuppressWrite = 1;
+                callbackRequest(&(uaItem->callback)); // out-records are SCAN="passive" so scanIoRequest doesn't work
             }
+            // else: the processing is requested already, it gets this value
         }
-        catch(dataChangeError) {
-            uaItem->stat = 1;
-        }
-        // I'm not shure about the posibility of another exception but of the damage it could do!
-        catch(...) {
-            uaItem->stat = 1;
-            if(debug || (uaItem->debug>= 2)) errlogPrintf("%s %s\tdataChange: unexpected exception '%s'\n",timeBuf,uaItem->prec->name,epicsTypeNames[uaItem->recDataType]);
-            uaItem->debug = 4;
-        }
+        else { // is IN Record
+            if(uaItem->prec->scan == SCAN_IO_EVENT)
+            {
+                if(!uaItem->ioScanGroup && !uaItem->buffered)
+                    scanIoRequest( uaItem->ioscanpvt );    // Update the record immediatly, for scan>SCAN_IO_EVENT update by periodic scan.
+                // Groups and buffered waveforms: once, after all notifications of this publish
+                else if(std::find(m_ioScanGroups.begin(), m_ioScanGroups.end(), uaItem->ioscanpvt) == m_ioScanGroups.end())
+                    m_ioScanGroups.push_back(uaItem->ioscanpvt);
+            }
 
-        // set Timestamp if specified by TSE field
-        UaDateTime dt = UaDateTime(dataNotifications[i].Value.ServerTimestamp);
-        if(uaItem->prec->tse == epicsTimeEventDeviceTime ) {
-            uaItem->prec->time.secPastEpoch = dt.toTime_t() - POSIX_TIME_AT_EPICS_EPOCH;
-            uaItem->prec->time.nsec         = dt.msec()*1000000L; // msec is 100ns steps
         }
-        if(uaItem->debug >= 4) {
-            errlogPrintf("server timestamp: %s, TSE:%d\n",dt.toString().toUtf8(),uaItem->prec->tse);
-        }
-        epicsMutexUnlock(uaItem->flagLock);
+    }
+    catch(dataChangeError) {
+        uaItem->stat = 1;
+    }
+    // I'm not shure about the posibility of another exception but of the damage it could do!
+    catch(...) {
+        uaItem->stat = 1;
+        if(debug || (uaItem->debug>= 2)) errlogPrintf("%s %s\tdataChange: unexpected exception '%s'\n",timeBuf,uaItem->prec->name,epicsTypeNames[uaItem->recDataType]);
+        uaItem->debug = 4;
+    }
+
+    // set Timestamp if specified by TSE field
+    const OpcUa_DateTime &dt = uaItem->tsSource ? value.SourceTimestamp : value.ServerTimestamp;
+    if(uaItem->prec->tse == epicsTimeEventDeviceTime ) {
+        uaToEpicsTime(dt, &uaItem->prec->time);
+    }
+    if(uaItem->debug >= 4) {
+        errlogPrintf("%s timestamp: %s, TSE:%d\n",uaItem->tsSource?"source":"server",UaDateTime(dt).toString().toUtf8(),uaItem->prec->tse);
+    }
+    epicsMutexUnlock(uaItem->flagLock);
 
 
-        if(uaItem->debug >= 4)
-            errlogPrintf("\tepicsType: %2d,%s opcType%2d:%s flagSuppressWrite:%d\n",
-                         uaItem->recDataType,epicsTypeNames[uaItem->recDataType],
-                    uaItem->itemDataType,variantTypeStrings(uaItem->itemDataType),
-                    uaItem->flagSuppressWrite);
-    } //end for
-    return;
+    if(uaItem->debug >= 4)
+        errlogPrintf("\tepicsType: %2d,%s opcType%2d:%s flagSuppressWrite:%d\n",
+                     uaItem->recDataType,epicsTypeNames[uaItem->recDataType],
+                uaItem->itemDataType,variantTypeStrings(uaItem->itemDataType),
+                uaItem->flagSuppressWrite);
 }
 
 void DevUaSubscription::newEvents(
@@ -142,22 +322,29 @@ UaStatus DevUaSubscription::createSubscription(UaSession *pSession)
 
     UaStatus result;
     ServiceSettings serviceSettings;
-    SubscriptionSettings subscriptionSettings;
-    subscriptionSettings.publishingInterval = 100;
-    if(debug) errlogPrintf("Creating subscription\n");
+    SubscriptionSettings subscriptionSettings = m_settings;   // revised by the server
+    if(debug) errlogPrintf("Creating subscription '%s'\n",m_name.c_str());
     result = pSession->createSubscription(
         serviceSettings,
         this,
-        1,
+        m_handle,
         subscriptionSettings,
         OpcUa_True,
         &m_pSubscription);
     if (result.isBad())
     {
-        errlogPrintf("DevUaSubscription::createSubscription failed with status %#8x (%s)\n",
+        errlogPrintf("DevUaSubscription::createSubscription '%s' failed with status %#8x (%s)\n",
+                     m_name.c_str(),
                      result.statusCode(),
                      result.toString().toUtf8());
     }
+    else {
+        m_lost = false;
+        m_vCreated.assign(m_vCreated.size(), 0);    // a new subscription has no items yet
+    }
+    if(result.isGood() && debug && (subscriptionSettings.publishingInterval != m_settings.publishingInterval))
+        errlogPrintf("Subscription '%s': publishing interval revised by server %g -> %g ms\n",
+                     m_name.c_str(), m_settings.publishingInterval, subscriptionSettings.publishingInterval);
     return result;
 }
 
@@ -165,8 +352,10 @@ UaStatus DevUaSubscription::deleteSubscription()
 {
     UaStatus result;
     ServiceSettings serviceSettings;
+    if(!m_pSubscription)
+        return result;
     // let the SDK cleanup the resources for the existing subscription
-    if(debug) errlogPrintf("Deleting subscription\n");
+    if(debug) errlogPrintf("Deleting subscription '%s'\n",m_name.c_str());
     result = m_pSession->deleteSubscription(
         serviceSettings,
         &m_pSubscription);
@@ -180,7 +369,103 @@ UaStatus DevUaSubscription::deleteSubscription()
     return result;
 }
 
-UaStatus DevUaSubscription::createMonitoredItems(std::vector<UaNodeId> &vUaNodeId,std::vector<OPCUA_ItemINFO *> *uaItemInfo)
+/* Set the DataChangeFilter of an item from its own settings or the defaults of the group.
+ * The groups deadband is used for numeric scalar nodes only, the server would reject the item otherwise.
+ * Without trigger and deadband no filter is sent, the server default is trigger StatusValue.
+ */
+void DevUaSubscription::getDataChangeFilter(const OPCUA_ItemINFO *uaItem, int *pTrigger, int *pDeadbandType, double *pDeadband)
+{
+    *pTrigger = (uaItem->trigger == FILTER_DEFAULT) ? m_trigger : uaItem->trigger;
+    *pDeadbandType = uaItem->deadbandType;
+    *pDeadband = uaItem->deadband;
+    if(*pDeadbandType == FILTER_DEFAULT) {
+        *pDeadbandType = DEADBAND_NONE;
+        if(uaItem->itemDataType >= OpcUaType_SByte && uaItem->itemDataType <= OpcUaType_Double && !uaItem->isArray) {
+            *pDeadbandType = m_deadbandType;
+            *pDeadband = m_deadband;
+        }
+    }
+}
+
+void DevUaSubscription::setDataChangeFilter(const OPCUA_ItemINFO *uaItem, OpcUa_ExtensionObject *pFilter)
+{
+    int trigger;
+    int deadbandType;
+    double deadband;
+    getDataChangeFilter(uaItem, &trigger, &deadbandType, &deadband);
+    if(trigger == TRIGGER_STATUSVALUE && deadbandType == DEADBAND_NONE)
+        return;
+
+    OpcUa_DataChangeFilter *pDataChangeFilter = NULL;
+    if(OpcUa_IsBad(OpcUa_EncodeableObject_CreateExtension(&OpcUa_DataChangeFilter_EncodeableType, pFilter, (OpcUa_Void**)&pDataChangeFilter)))
+        return;
+    pDataChangeFilter->Trigger       = (OpcUa_DataChangeTrigger) trigger;
+    pDataChangeFilter->DeadbandType  = deadbandType;
+    pDataChangeFilter->DeadbandValue = deadband;
+    if(uaItem->debug >= 2)
+        errlogPrintf("%s DataChangeFilter trigger %d deadband type %d value %g\n",uaItem->prec->name,trigger,deadbandType,deadband);
+}
+
+/* createMonitoredItems of a part of the items. Only status and revised values of the results are kept */
+class CreateMonitoredItemsJob : public DevUaChunkJob {
+public:
+    CreateMonitoredItemsJob(UaSubscription *pSubscription, OpcUa_TimestampsToReturn timestampsToReturn,
+                            UaMonitoredItemCreateRequests &items, UaMonitoredItemCreateResults &results)
+        : m_pSubscription(pSubscription), m_timestampsToReturn(timestampsToReturn)
+        , m_items(items), m_results(results) {}
+    virtual void runChunk(OpcUa_UInt32 first, OpcUa_UInt32 count) {
+        ServiceSettings               serviceSettings;
+        UaMonitoredItemCreateRequests part;
+        UaMonitoredItemCreateResults  results;
+        part.attach(count, &m_items[first]);    // no copy, detached again below
+        UaStatus result = m_pSubscription->createMonitoredItems(serviceSettings, m_timestampsToReturn, part, results);
+        part.detach();
+        for(OpcUa_UInt32 i=0; i<count; i++) {
+            OpcUa_MonitoredItemCreateResult &r = m_results[first+i];
+            if(result.isBad() || i >= results.length()) {
+                r.StatusCode = result.isBad() ? result.statusCode() : (OpcUa_StatusCode) OpcUa_BadInternalError;
+                continue;
+            }
+            r.StatusCode = results[i].StatusCode;
+            r.MonitoredItemId = results[i].MonitoredItemId;
+            r.RevisedSamplingInterval = results[i].RevisedSamplingInterval;
+            r.RevisedQueueSize = results[i].RevisedQueueSize;
+        }
+        if(result.isBad())
+            setStatus(result.statusCode());
+    }
+private:
+    UaSubscription *m_pSubscription;
+    OpcUa_TimestampsToReturn m_timestampsToReturn;
+    UaMonitoredItemCreateRequests &m_items;
+    UaMonitoredItemCreateResults &m_results;
+};
+
+/* Records with the same node and monitoring parameters share one monitored item */
+struct MonitoredItemKey {
+    UaNodeId node;
+    double   samplingInterval;
+    int      queueSize;
+    int      discardOldest;
+    int      trigger;
+    int      deadbandType;
+    double   deadband;
+    bool operator<(const MonitoredItemKey &k) const {
+        if(samplingInterval != k.samplingInterval) return samplingInterval < k.samplingInterval;
+        if(queueSize != k.queueSize) return queueSize < k.queueSize;
+        if(discardOldest != k.discardOldest) return discardOldest < k.discardOldest;
+        if(trigger != k.trigger) return trigger < k.trigger;
+        if(deadbandType != k.deadbandType) return deadbandType < k.deadbandType;
+        if(deadband != k.deadband) return deadband < k.deadband;
+        return node < k.node;
+    }
+};
+
+/* Create the monitored items of this subscription group in calls of at most chunk items, 0: no limit.
+ * Records of the same node and parameters get one monitored item, its client handle is the index of
+ * the first record, m_vNextItem chains the others for processDataValue().
+ */
+UaStatus DevUaSubscription::createMonitoredItems(std::vector<UaNodeId> &vUaNodeId,std::vector<OPCUA_ItemINFO *> *uaItemInfo,OpcUa_UInt32 chunk)
 {
     if(debug) errlogPrintf("DevUaSubscription::createMonitoredItems\n");
     if( uaItemInfo->size() == vUaNodeId.size())
@@ -190,66 +475,229 @@ UaStatus DevUaSubscription::createMonitoredItems(std::vector<UaNodeId> &vUaNodeI
         errlogPrintf("\nDevUaSubscription::createMonitoredItems Error: Nr of uaItems %i != nr of browsepathItems %i\n",(int)uaItemInfo->size(),(int)vUaNodeId.size());
         return OpcUa_BadInvalidState;
     }
+
+    UaStatus result;
+    OpcUa_UInt32 i;
+    std::vector<OpcUa_UInt32> vIdx;     // index of the monitored item -> index of uaItemInfo, the client handle
+    std::vector<OpcUa_UInt32> vNext(vUaNodeId.size(), NO_ITEM);
+    std::vector<OpcUa_UInt32> vLast;    // per monitored item: the last record of its chain
+    std::map<MonitoredItemKey, OpcUa_UInt32> items;     // -> index of vIdx
+    int useSource = 0;
+    int useServer = 0;
+    m_monitoredRecords = 0;
+    // Collect the items of this subscription group
+    for(i=0; i<vUaNodeId.size(); i++) {
+        OPCUA_ItemINFO *uaItem = uaItemInfo->at(i);
+        if(uaItem->subscription != (int) m_handle || uaItem->pollInterval > 0)
+            continue;           // poll groups: read by DevUaClient::poll()
+        if ( !vUaNodeId[i].isNull() ) {
+            MonitoredItemKey key;
+            key.node = vUaNodeId[i];
+            key.samplingInterval = uaItem->samplingInterval;
+            key.queueSize = uaItem->queueSize;
+            key.discardOldest = uaItem->discardOldest;
+            getDataChangeFilter(uaItem, &key.trigger, &key.deadbandType, &key.deadband);
+            std::map<MonitoredItemKey, OpcUa_UInt32>::iterator it = items.find(key);
+            if(it == items.end()) {
+                items.insert(std::make_pair(key, (OpcUa_UInt32) vIdx.size()));
+                vIdx.push_back(i);
+                vLast.push_back(i);
+            }
+            else {
+                vNext[vLast[it->second]] = i;
+                vLast[it->second] = i;
+            }
+            m_monitoredRecords++;
+        }
+        else
+            errlogPrintf("%s Skip illegal node: %s\n",uaItem->prec->name,uaItem->ItemPath);
+        if(uaItem->prec->tse == epicsTimeEventDeviceTime || uaItem->buffered == BUFFER_TIME) {
+            if(uaItem->tsSource) useSource = 1;
+            else                 useServer = 1;
+        }
+    }
+    // Notifications of the old items may still be processed: swap in the new chains under the lock
+    epicsMutexLock(m_chainLock);
+    m_vNextItem.swap(vNext);
+    epicsMutexUnlock(m_chainLock);
+    m_vLeader = vIdx;
+    m_vCreated.assign(vIdx.size(), 0);
+    m_vNodeUnknown.assign(vIdx.size(), 0);
+    m_vItemId.assign(vIdx.size(), 0);
+    m_monitoredItems = vIdx.size();
+    if(vIdx.empty()) {
+        if(debug) errlogPrintf("Subscription '%s': no items\n",m_name.c_str());
+        return result;
+    }
+    // Request only the timestamps used by any record
+    if(useSource)
+        m_timestampsToReturn = useServer ? OpcUa_TimestampsToReturn_Both : OpcUa_TimestampsToReturn_Source;
+    else
+        m_timestampsToReturn = useServer ? OpcUa_TimestampsToReturn_Server : OpcUa_TimestampsToReturn_Neither;
+    if(debug) errlogPrintf("\nAdd %u monitored items for %u records to subscription '%s' ...\n",(unsigned int)vIdx.size(),m_monitoredRecords,m_name.c_str());
+    // The item table is kept without a session: the retry creates the items by recreateFailedItems()
     if(false == m_pSession->isConnected() ) {
         errlogPrintf("\nDevUaSubscription::createMonitoredItems Error: session not connected\n");
         return OpcUa_BadInvalidState;
-
     }
+    std::vector<OpcUa_UInt32> vAll(vIdx.size());
+    for(i=0; i<vIdx.size(); i++)
+        vAll[i] = i;
+    return createItems(vAll, vUaNodeId, chunk);
+}
 
+/* Create the monitored items vItems (index of m_vLeader) and note which ones the server accepted */
+UaStatus DevUaSubscription::createItems(const std::vector<OpcUa_UInt32> &vItems, std::vector<UaNodeId> &vUaNodeId, OpcUa_UInt32 chunk)
+{
     UaStatus result;
     OpcUa_UInt32 i;
-    ServiceSettings serviceSettings;
     UaMonitoredItemCreateRequests itemsToCreate;
     UaMonitoredItemCreateResults createResults;
-    // Configure one item to add to subscription
-    // We monitor the value of the ServerStatus -> CurrentTime
-    itemsToCreate.create(vUaNodeId.size());
-    for(i=0; i<vUaNodeId.size(); i++) {
-        if ( !vUaNodeId[i].isNull() ) {
-            UaNodeId tempNode(vUaNodeId[i]);
-            itemsToCreate[i].ItemToMonitor.AttributeId = OpcUa_Attributes_Value;
-            tempNode.copyTo(&(itemsToCreate[i].ItemToMonitor.NodeId));
-            itemsToCreate[i].RequestedParameters.ClientHandle = i;
-            itemsToCreate[i].RequestedParameters.SamplingInterval = 100;
-            itemsToCreate[i].RequestedParameters.QueueSize = 1;
-            itemsToCreate[i].RequestedParameters.DiscardOldest = OpcUa_True;
-            itemsToCreate[i].MonitoringMode = OpcUa_MonitoringMode_Reporting;
-        }
-        else {
-            errlogPrintf("%s Skip illegal node: %s\n",uaItemInfo->at(i)->prec->name,uaItemInfo->at(i)->ItemPath);
-        }
+
+    itemsToCreate.create(vItems.size());
+    for(i=0; i<vItems.size(); i++) {
+        OpcUa_UInt32 idx = m_vLeader[vItems[i]];
+        OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(idx);
+        UaNodeId tempNode(vUaNodeId[idx]);
+        itemsToCreate[i].ItemToMonitor.AttributeId = OpcUa_Attributes_Value;
+        tempNode.copyTo(&(itemsToCreate[i].ItemToMonitor.NodeId));
+        itemsToCreate[i].RequestedParameters.ClientHandle = idx;
+        itemsToCreate[i].RequestedParameters.SamplingInterval = uaItem->samplingInterval;
+        itemsToCreate[i].RequestedParameters.QueueSize = uaItem->queueSize;
+        itemsToCreate[i].RequestedParameters.DiscardOldest = uaItem->discardOldest ? OpcUa_True : OpcUa_False;
+        itemsToCreate[i].MonitoringMode = OpcUa_MonitoringMode_Reporting;
+        setDataChangeFilter(uaItem, &itemsToCreate[i].RequestedParameters.Filter);
     }
-    if(debug) errlogPrintf("\nAdd monitored items to subscription ...\n");
-    result = m_pSubscription->createMonitoredItems(
-        serviceSettings,
-        OpcUa_TimestampsToReturn_Both,
-        itemsToCreate,
-        createResults);
-    if (result.isGood())
+    createResults.create(vItems.size());
+    CreateMonitoredItemsJob job(m_pSubscription, m_timestampsToReturn, itemsToCreate, createResults);
+    runChunks(job, vItems.size(), chunk);
+    result = job.status;
+    if(result.isBad())
+       errlogPrintf("DevUaSubscription::createMonitoredItems service call failed with status %s\n", result.toString().toUtf8());
+    // check individual results, the items of a failed chunk have its status
+    for (i = 0; i < createResults.length(); i++)
     {
-        // check individual results
-        for (i = 0; i < createResults.length(); i++)
+        OpcUa_UInt32 idx = m_vLeader[vItems[i]];
+        OPCUA_ItemINFO* uaItem = m_vectorUaItemInfo->at(idx);
+        m_vCreated[vItems[i]] = OpcUa_IsGood(createResults[i].StatusCode);
+        m_vNodeUnknown[vItems[i]] = (createResults[i].StatusCode == OpcUa_BadNodeIdUnknown ||
+                                     createResults[i].StatusCode == OpcUa_BadNodeIdInvalid);
+        m_vItemId[vItems[i]] = createResults[i].MonitoredItemId;
+        if (OpcUa_IsGood(createResults[i].StatusCode))
         {
-            if (OpcUa_IsGood(createResults[i].StatusCode))
-            {
-                if(debug>1) errlogPrintf("%4d: %s\n",i,
-                    UaNodeId(itemsToCreate[i].ItemToMonitor.NodeId).toXmlString().toUtf8());
-            }
-            else
-            {
-                if(debug) {
-                    OPCUA_ItemINFO* uaItem = m_vectorUaItemInfo->at(i);
-                    errlogPrintf("%4d %s DevUaSubscription::createMonitoredItems failed for node: %s - Status %s\n",
-                        i, uaItem->prec->name,
-                        UaNodeId(itemsToCreate[i].ItemToMonitor.NodeId).toXmlString().toUtf8(),
-                        UaStatus(createResults[i].StatusCode).toString().toUtf8());
+            if(debug>1) errlogPrintf("%4d: %s\n",idx,
+                UaNodeId(itemsToCreate[i].ItemToMonitor.NodeId).toXmlString().toUtf8());
+            if((debug || uaItem->debug >= 2) &&
+               ((createResults[i].RevisedSamplingInterval != uaItem->samplingInterval) ||
+                (createResults[i].RevisedQueueSize != (OpcUa_UInt32) uaItem->queueSize)))
+                errlogPrintf("%s monitored item revised by server: sampling %g -> %g ms, queue %d -> %u\n",
+                    uaItem->prec->name, uaItem->samplingInterval, createResults[i].RevisedSamplingInterval,
+                    uaItem->queueSize, createResults[i].RevisedQueueSize);
+        }
+        else if(debug)
+        {
+            for(; idx != NO_ITEM; idx = m_vNextItem[idx])
+                errlogPrintf("%4d %s DevUaSubscription::createMonitoredItems failed for node: %s - Status %s\n",
+                    idx, m_vectorUaItemInfo->at(idx)->prec->name,
+                    UaNodeId(itemsToCreate[i].ItemToMonitor.NodeId).toXmlString().toUtf8(),
+                    UaStatus(createResults[i].StatusCode).toString().toUtf8());
+        }
+    }
+    return result;
+}
+
+/* The subscription survived a connection loss: create the monitored items the server rejected before */
+UaStatus DevUaSubscription::recreateFailedItems(std::vector<UaNodeId> &vUaNodeId, OpcUa_UInt32 chunk)
+{
+    std::vector<OpcUa_UInt32> vFailed;
+    for(OpcUa_UInt32 i=0; i<m_vCreated.size(); i++)
+        if(!m_vCreated[i])
+            vFailed.push_back(i);
+    if(vFailed.empty())
+        return UaStatus();
+    if(debug) errlogPrintf("Subscription '%s': create %u failed monitored items again\n",m_name.c_str(),(unsigned int)vFailed.size());
+    return createItems(vFailed, vUaNodeId, chunk);
+}
+
+/* The subscription survived a connection loss, but the nodes were translated again (the server's
+ * NamespaceArray changed): delete the monitored items whose node changed and create them again.
+ */
+UaStatus DevUaSubscription::recreateChangedItems(const std::vector<UaNodeId> &vOldNodeId, std::vector<UaNodeId> &vUaNodeId, OpcUa_UInt32 chunk)
+{
+    ServiceSettings serviceSettings;
+    UaUInt32Array itemIds;
+    UaStatusCodeArray results;
+    std::vector<OpcUa_UInt32> vChanged;
+    OpcUa_UInt32 i;
+
+    for(i=0; i<m_vLeader.size(); i++) {
+        OpcUa_UInt32 idx = m_vLeader[i];
+        if(idx < vOldNodeId.size() && idx < vUaNodeId.size() && vOldNodeId[idx] != vUaNodeId[idx])
+            vChanged.push_back(i);
+    }
+    if(vChanged.empty() || !m_pSubscription)
+        return UaStatus();
+    itemIds.create(vChanged.size());
+    OpcUa_UInt32 n = 0;
+    for(i=0; i<vChanged.size(); i++) {
+        if(m_vCreated[vChanged[i]])
+            itemIds[n++] = m_vItemId[vChanged[i]];
+        m_vCreated[vChanged[i]] = 0;
+    }
+    itemIds.resize(n);
+    if(n > 0) {
+        UaStatus status = m_pSubscription->deleteMonitoredItems(serviceSettings, itemIds, results);
+        if(status.isBad())
+            errlogPrintf("Subscription '%s': DeleteMonitoredItems failed with status %s\n",
+                         m_name.c_str(), status.toString().toUtf8());
+    }
+    if(debug) errlogPrintf("Subscription '%s': create %u monitored items of changed nodes again\n",
+                           m_name.c_str(), (unsigned int) vChanged.size());
+    return createItems(vChanged, vUaNodeId, chunk);
+}
+
+/* Client handles of the monitored items the server rejected for an unknown or invalid NodeId */
+void DevUaSubscription::unknownNodeItems(std::vector<OpcUa_UInt32> &vIdx) const
+{
+    for(OpcUa_UInt32 i=0; i<m_vNodeUnknown.size(); i++)
+        if(m_vNodeUnknown[i])
+            vIdx.push_back(m_vLeader[i]);
+}
+
+/* The subscription survived a connection loss: the server kept the monitored items and sends
+ * the changes missed meanwhile, values without change are still valid. Clear the bad status
+ * set by the connection loss and process the records again, without any service call.
+ */
+void DevUaSubscription::restoreItems()
+{
+    std::vector<IOSCANPVT> ioScanPvts;
+    unsigned int n = 0;
+    epicsMutexLock(m_chainLock);
+    for(OpcUa_UInt32 i=0; i<m_vLeader.size(); i++) {
+        if(!m_vCreated[i])
+            continue;
+        for(OpcUa_UInt32 idx = m_vLeader[i]; idx != NO_ITEM; idx = m_vNextItem[idx]) {
+            OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(idx);
+            epicsMutexLock(uaItem->flagLock);
+            if(uaItem->connLost) {
+                uaItem->connLost = 0;
+                uaItem->stat = 0;
+                n++;
+                if(uaItem->inpDataType) {   // OUT record: process as readback, see processItem()
+                    if(uaItem->flagSuppressWrite==0) {
+                        uaItem->flagSuppressWrite = 1;
+                        callbackRequest(&(uaItem->callback));
+                    }
                 }
+                else if(uaItem->prec->scan == SCAN_IO_EVENT &&
+                   std::find(ioScanPvts.begin(), ioScanPvts.end(), uaItem->ioscanpvt) == ioScanPvts.end())
+                    ioScanPvts.push_back(uaItem->ioscanpvt);
             }
+            epicsMutexUnlock(uaItem->flagLock);
         }
     }
-    else
-    {
-       if(debug)  errlogPrintf("DevUaSubscription::createMonitoredItems service call failed with status %s\n", result.toString().toUtf8());
-    }
-    return result;
+    epicsMutexUnlock(m_chainLock);
+    for(std::vector<IOSCANPVT>::iterator it = ioScanPvts.begin(); it != ioScanPvts.end(); ++it)
+        scanIoRequest(*it);
+    if(debug) errlogPrintf("Subscription '%s': %u records restored\n",m_name.c_str(),n);
 }
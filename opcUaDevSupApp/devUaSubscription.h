@@ -20,14 +20,37 @@
 
 #include "uabase.h"
 #include "uaclientsdk.h"
+#include <string>
 #include <dbCommon.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsRingPointer.h>
 using namespace UaClientSdk;
+
+#define NO_ITEM 0xffffffff      // end of a m_vNextItem chain
+
+/* Entry of the dataChange handoff queue: a raw copy of one notification */
+typedef struct {
+    OpcUa_UInt32    clientHandle;
+    OpcUa_DataValue value;
+} DevUaQueueEntry;
+
+/* Subscription group: settings of one subscription, defined by opcuaSubscription() */
+typedef struct {
+    std::string          name;
+    SubscriptionSettings settings;
+    int                  trigger;       // default DataChangeFilter of the items
+    int                  deadbandType;
+    double               deadband;
+} DevUaSubscriptionGroup;
+
 class DevUaSubscription :
     public UaSubscriptionCallback
 {
     UA_DISABLE_COPY(DevUaSubscription);
 public:
-    DevUaSubscription(int debug);
+    DevUaSubscription(int debug, OpcUa_UInt32 handle, const DevUaSubscriptionGroup &group);
     virtual ~DevUaSubscription();
 
     virtual void subscriptionStatusChanged(
@@ -43,12 +66,56 @@ public:
 
     UaStatus createSubscription(UaSession *pSession);
     UaStatus deleteSubscription();
-    UaStatus createMonitoredItems(std::vector<UaNodeId> &vUaNodeId,std::vector<OPCUA_ItemINFO *> *m_vectorUaItemInfo);
+    UaStatus createMonitoredItems(std::vector<UaNodeId> &vUaNodeId,std::vector<OPCUA_ItemINFO *> *m_vectorUaItemInfo,OpcUa_UInt32 chunk);
+    UaStatus recreateFailedItems(std::vector<UaNodeId> &vUaNodeId, OpcUa_UInt32 chunk);
+    void unknownNodeItems(std::vector<OpcUa_UInt32> &vIdx) const;
+    UaStatus recreateChangedItems(const std::vector<UaNodeId> &vOldNodeId, std::vector<UaNodeId> &vUaNodeId, OpcUa_UInt32 chunk);
+    void restoreItems();
+    bool isLost() const { return m_lost || !m_pSubscription; }
+    void queueStat();
 
     int debug;              // debug output independant from single channels
 private:
+    UaStatus createItems(const std::vector<OpcUa_UInt32> &vItems, std::vector<UaNodeId> &vUaNodeId, OpcUa_UInt32 chunk);
+    void processDataValue(OpcUa_UInt32 clientHandle, const OpcUa_DataValue &value);
+    void processItem(OPCUA_ItemINFO* uaItem, OpcUa_UInt32 clientHandle, const OpcUa_DataValue &value);
+    void queueDataValue(OpcUa_UInt32 clientHandle, const OpcUa_DataValue &value);
+    void drainQueue();
+    void requestIoScanGroups();
+    void getDataChangeFilter(const OPCUA_ItemINFO *uaItem, int *pTrigger, int *pDeadbandType, double *pDeadband);
+    void setDataChangeFilter(const OPCUA_ItemINFO *uaItem, OpcUa_ExtensionObject *pFilter);
+    static void queueConsumer(void *pSubscription);
+
     UaSession*                  m_pSession;
     UaSubscription*             m_pSubscription;
+    OpcUa_UInt32                m_handle;       // index of the subscription group
+    std::string                 m_name;
+    SubscriptionSettings        m_settings;
+    int                         m_trigger;
+    int                         m_deadbandType;
+    double                      m_deadband;
     std::vector<OPCUA_ItemINFO *> *m_vectorUaItemInfo;
+    std::vector<IOSCANPVT>        m_ioScanGroups;   // I/O scan groups to be scanned after this update
+    std::vector<OpcUa_UInt32>     m_vNextItem;      // next record sharing the monitored item or NO_ITEM
+    epicsMutexId                  m_chainLock;      // m_vNextItem: replaced while notifications are processed
+    std::vector<OpcUa_UInt32>     m_vLeader;        // per monitored item: its client handle
+    std::vector<char>             m_vCreated;       // per monitored item: accepted by the server
+    std::vector<char>             m_vNodeUnknown;   // per monitored item: rejected for its NodeId
+    std::vector<OpcUa_UInt32>     m_vItemId;        // per monitored item: MonitoredItemId of the server
+    OpcUa_UInt32                m_monitoredItems;
+    OpcUa_UInt32                m_monitoredRecords;
+    OpcUa_TimestampsToReturn    m_timestampsToReturn;
+    volatile bool               m_lost;         // subscriptionStatusChanged(): the server dropped it
+
+    /* Handoff queue, active if dataChangeQueueSize > 0. dataChange() is the only
+     * producer, queueConsumer() the only consumer, so the rings need no lock. */
+    int                 m_queueSize;
+    DevUaQueueEntry*    m_queueEntries;
+    epicsRingPointerId  m_queueFree;        // unused entries, consumer -> producer
+    epicsRingPointerId  m_queueData;        // filled entries, producer -> consumer
+    epicsEventId        m_queueEvent;
+    epicsEventId        m_queueExit;
+    volatile int        m_queueRun;
+    unsigned long       m_queueOverflows;
 };
 #endif // DEVUASUBSCRIPTION_H
@@ -0,0 +1,223 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "uabase.h"
+#include <dbCommon.h>
+#include <errlog.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsStdio.h>
+#include <epicsExport.h>
+
+#include "drvOpcUa.h"
+#include "devUaTrace.h"
+
+typedef struct {
+    epicsTimeStamp time;
+    const OPCUA_ItemINFO *uaItem;
+    epicsUInt16 event;
+    epicsUInt16 type;
+    unsigned char raw[TRACE_RAW_SIZE];
+} DevUaTraceEntry;
+
+typedef struct {
+    char thread[32];
+    unsigned int size;
+    unsigned int next;      /* written by the owning thread only */
+    unsigned int wrapped;
+    DevUaTraceEntry *entry;
+} DevUaTraceRing;
+
+/* Entries per thread ring, set before iocInit */
+static int traceRingSize = 1024;
+extern "C" {
+epicsExportAddress(int, traceRingSize);
+}
+
+static epicsThreadOnceId traceOnce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId traceRingId;
+static epicsMutexId traceLock;          /* protects traceRings, taken on ring creation and dump only */
+static std::vector<DevUaTraceRing *> traceRings;
+
+static void traceInit(void *)
+{
+    traceRingId = epicsThreadPrivateCreate();
+    traceLock = epicsMutexMustCreate();
+}
+
+/* First trace of a thread: create its ring and register it for the dump */
+static DevUaTraceRing *traceRingCreate()
+{
+    DevUaTraceRing *pRing = (DevUaTraceRing *) calloc(1, sizeof(DevUaTraceRing));
+    if(!pRing)
+        return NULL;
+    pRing->size = (traceRingSize > 0) ? traceRingSize : 1024;
+    pRing->entry = (DevUaTraceEntry *) calloc(pRing->size, sizeof(DevUaTraceEntry));
+    if(!pRing->entry) {
+        free(pRing);
+        return NULL;
+    }
+    strncpy(pRing->thread, epicsThreadGetNameSelf(), sizeof(pRing->thread)-1);
+    epicsThreadPrivateSet(traceRingId, pRing);
+    epicsMutexLock(traceLock);
+    traceRings.push_back(pRing);
+    epicsMutexUnlock(traceLock);
+    return pRing;
+}
+
+/* Switch tracing of an item on or off. The trace keys are created here, so the hot path doesn't need epicsThreadOnce() */
+void opcUaTraceEnable(OPCUA_ItemINFO *uaItem, int on)
+{
+    epicsThreadOnce(&traceOnce, traceInit, NULL);
+    uaItem->trace = on;
+}
+
+void opcUaTrace(const OPCUA_ItemINFO *uaItem, int event, int type, const void *pRaw)
+{
+    DevUaTraceRing *pRing = (DevUaTraceRing *) epicsThreadPrivateGet(traceRingId);
+    if(!pRing && !(pRing = traceRingCreate()))
+        return;
+
+    DevUaTraceEntry *pEntry = &pRing->entry[pRing->next];
+    size_t size = TRACE_RAW_SIZE;
+    if((event != traceDataChange) && (event != traceBadStatus) && (epicsTypeSizes[type] < size))
+        size = epicsTypeSizes[type];
+    epicsTimeGetCurrent(&pEntry->time);
+    pEntry->uaItem = uaItem;
+    pEntry->event  = (epicsUInt16) event;
+    pEntry->type   = (epicsUInt16) type;
+    memset(pEntry->raw, 0, TRACE_RAW_SIZE);
+    memcpy(pEntry->raw, pRaw, size);
+    if(++pRing->next == pRing->size) {
+        pRing->next = 0;
+        pRing->wrapped = 1;
+    }
+}
+
+/* Decoding, done by opcUaTraceDump() only */
+
+typedef struct {
+    DevUaTraceEntry entry;
+    const char *thread;
+} DevUaTraceDumpEntry;
+
+static bool traceEarlier(const DevUaTraceDumpEntry &a, const DevUaTraceDumpEntry &b)
+{
+    if(a.entry.time.secPastEpoch != b.entry.time.secPastEpoch)
+        return a.entry.time.secPastEpoch < b.entry.time.secPastEpoch;
+    return a.entry.time.nsec < b.entry.time.nsec;
+}
+
+template<typename T> static T rawAs(const DevUaTraceEntry &e)
+{
+    T val;
+    memcpy(&val, e.raw, sizeof(T));
+    return val;
+}
+
+static void traceOpcValue(const DevUaTraceEntry &e, char *buf, size_t len)
+{
+    if(e.type & TRACE_ARRAY) {
+        epicsSnprintf(buf, len, "%s[%d]", variantTypeStrings(e.type & ~TRACE_ARRAY), rawAs<OpcUa_Int32>(e));
+        return;
+    }
+    switch(e.type) {
+    case OpcUaType_Boolean: epicsSnprintf(buf, len, "%d", rawAs<OpcUa_Boolean>(e)); break;
+    case OpcUaType_SByte:   epicsSnprintf(buf, len, "%d", rawAs<OpcUa_SByte>(e)); break;
+    case OpcUaType_Byte:    epicsSnprintf(buf, len, "%u", rawAs<OpcUa_Byte>(e)); break;
+    case OpcUaType_Int16:   epicsSnprintf(buf, len, "%d", rawAs<OpcUa_Int16>(e)); break;
+    case OpcUaType_UInt16:  epicsSnprintf(buf, len, "%u", rawAs<OpcUa_UInt16>(e)); break;
+    case OpcUaType_Int32:   epicsSnprintf(buf, len, "%d", rawAs<OpcUa_Int32>(e)); break;
+    case OpcUaType_UInt32:  epicsSnprintf(buf, len, "%u", rawAs<OpcUa_UInt32>(e)); break;
+    case OpcUaType_Float:   epicsSnprintf(buf, len, "%g", rawAs<OpcUa_Float>(e)); break;
+    case OpcUaType_Double:  epicsSnprintf(buf, len, "%g", rawAs<OpcUa_Double>(e)); break;
+    default:                epicsSnprintf(buf, len, "<%s>", variantTypeStrings(e.type)); break;
+    }
+}
+
+static void traceRecValue(const DevUaTraceEntry &e, char *buf, size_t len)
+{
+    switch(e.type) {
+    case epicsInt32T:   epicsSnprintf(buf, len, "%d", rawAs<epicsInt32>(e)); break;
+    case epicsUInt32T:  epicsSnprintf(buf, len, "%u", rawAs<epicsUInt32>(e)); break;
+    case epicsFloat64T: epicsSnprintf(buf, len, "%g", rawAs<epicsFloat64>(e)); break;
+    case epicsStringT:
+    case epicsOldStringT:
+        epicsSnprintf(buf, len, "'%.*s'", TRACE_RAW_SIZE, (const char *) e.raw); break;
+    default:            epicsSnprintf(buf, len, "<%s>", epicsTypeNames[e.type]); break;
+    }
+}
+
+static const char *traceEventNames[] = {"?", "dataChange", "badStatus", "read", "write", "writeFailed"};
+
+/* Print the last count entries of all threads in time order.
+ * The rings are not stopped, entries written during the dump may be inconsistent.
+ */
+void opcUaTraceDump(int count)
+{
+    std::vector<DevUaTraceDumpEntry> entries;
+    char timeBuf[30];
+    char valBuf[40];
+    size_t nRings;
+
+    epicsThreadOnce(&traceOnce, traceInit, NULL);
+    epicsMutexLock(traceLock);
+    for(std::vector<DevUaTraceRing *>::iterator it = traceRings.begin(); it != traceRings.end(); ++it) {
+        DevUaTraceRing *pRing = *it;
+        unsigned int next = pRing->next;
+        unsigned int n = pRing->wrapped ? pRing->size : next;
+        for(unsigned int i = 0; i < n; i++) {
+            DevUaTraceDumpEntry d;
+            d.entry  = pRing->entry[(next + pRing->size - n + i) % pRing->size];
+            d.thread = pRing->thread;
+            entries.push_back(d);
+        }
+    }
+    nRings = traceRings.size();
+    epicsMutexUnlock(traceLock);
+
+    std::sort(entries.begin(), entries.end(), traceEarlier);
+    size_t first = 0;
+    if(count > 0 && entries.size() > (size_t) count)
+        first = entries.size() - count;
+    for(size_t i = first; i < entries.size(); i++) {
+        const DevUaTraceEntry &e = entries[i].entry;
+        switch(e.event) {
+        case traceDataChange:
+            traceOpcValue(e, valBuf, sizeof(valBuf));
+            break;
+        case traceBadStatus:
+            epicsSnprintf(valBuf, sizeof(valBuf), "%s", UaStatus(rawAs<OpcUa_StatusCode>(e)).toString().toUtf8());
+            break;
+        default:
+            traceRecValue(e, valBuf, sizeof(valBuf));
+            break;
+        }
+        epicsTimeToStrftime(timeBuf, 28, "%y-%m-%dT%H:%M:%S.%06f", &e.time);
+        errlogPrintf("%s %-16s %-32s %-11s %s\n", timeBuf, entries[i].thread, e.uaItem->prec->name,
+                     traceEventNames[(e.event <= traceWriteFailed) ? e.event : 0], valBuf);
+    }
+    errlogPrintf("%lu of %lu trace entries from %lu threads\n", (unsigned long) (entries.size() - first),
+                 (unsigned long) entries.size(), (unsigned long) nRings);
+}
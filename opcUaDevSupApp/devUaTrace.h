@@ -0,0 +1,49 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef INCdevUaTraceH
+#define INCdevUaTraceH
+
+#include <devOpcUa.h>
+
+/* Binary trace: each thread writes fixed size entries to its own ring buffer,
+ * no formatting, no locks. opcUaTraceDump() decodes the rings on demand.
+ */
+#define TRACE_RAW_SIZE 8
+#define TRACE_ARRAY     0x8000  /* traceDataChange: type is an array, raw = length */
+
+typedef enum {
+    traceDataChange = 1,    /* value from the server:   type = OPC type, raw = value */
+    traceBadStatus,         /* bad status from server:  raw = status code */
+    traceRead,              /* IN record processed:     type = epicsType, raw = value */
+    traceWrite,             /* OUT record written:      type = epicsType, raw = value */
+    traceWriteFailed        /* write to server failed:  type = epicsType, raw = value */
+} OpcUaTraceEvent;
+
+#define TRACE(uaItem,event,type,pRaw) do { if((uaItem)->trace) opcUaTrace((uaItem),(event),(type),(pRaw)); } while(0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern void opcUaTraceEnable(OPCUA_ItemINFO *uaItem, int on);
+extern void opcUaTrace(const OPCUA_ItemINFO *uaItem, int event, int type, const void *pRaw);
+extern void opcUaTraceDump(int count);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,16 +17,17 @@
 \*************************************************************************/
 
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 
-#include <boost/algorithm/string.hpp>
 #include <string>
+#include <deque>
 #include <vector>
-
-// regex and stoi for lexical_cast are available as std functions in C11
-//#include <regex> 
-#include <boost/regex.hpp>
-#include <boost/lexical_cast.hpp>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <limits>
+#include <math.h>
 
 // EPICS LIBS
 #define epicsTypesGLOBAL
@@ -34,9 +35,15 @@
 #include <epicsPrint.h>
 #include <epicsTime.h>
 #include <epicsTimer.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
 #include <epicsExport.h>
 #include <registryFunction.h>
 #include <dbCommon.h>
+#include <dbAccess.h>
+#include <callback.h>
+#include <alarm.h>
 #include <devSup.h>
 #include <drvSup.h>
 #include <devLib.h>
@@ -50,6 +57,8 @@
 
 #include "drvOpcUa.h"
 #include "devUaSubscription.h"
+#include "devUaTrace.h"
+#include "devUaNodeCache.h"
 
 // Wrapper to ignore return values
 template<typename T>
@@ -112,9 +121,104 @@ inline const char *serverStatusStrings(UaClient::ServerStatus type)
     }
 }
 
+/* Subscription groups, defined by opcuaSubscription() before drvOpcuaSetup().
+ * Records select a group by the link option sub=NAME. Group 0 is the default subscription.
+ */
+typedef DevUaSubscriptionGroup SubscriptionGroup;
+
+static bool subscriptionGroupsFixed = false;    // set when the first client creates its subscriptions
+
+static std::vector<SubscriptionGroup> &getSubscriptionGroups()
+{
+    static std::vector<SubscriptionGroup> groups;
+    if(groups.empty()) {
+        SubscriptionGroup defaultGroup;
+        defaultGroup.name = "default";
+        defaultGroup.settings.publishingInterval = 100;
+        defaultGroup.trigger = TRIGGER_STATUSVALUE;
+        defaultGroup.deadbandType = DEADBAND_NONE;
+        defaultGroup.deadband = 0.0;
+        groups.push_back(defaultGroup);
+    }
+    return groups;
+}
+
 //inline int64_t getMsec(DateTime dateTime){ return (dateTime.Value % 10000000LL)/10000; }
 
 class autoSessionConnect;
+class writeBatchTimer;
+class DevUaPollGroup;
+
+/* A write waiting for the next Write service call. The entries are reused, see queueWriteLocked() */
+typedef struct {
+    OPCUA_ItemINFO *uaItem;
+    UaVariant value;
+} PendingWrite;
+
+/* An outstanding Write call, its index is the transactionId. Free slots are reused with their
+ * item vector, so a write needs no allocation once the pool has grown. */
+typedef std::vector<OPCUA_ItemINFO *> WriteTransaction;
+
+/* Browse path element as parsed from the link, name points into the link, not terminated */
+typedef struct {
+    OpcUa_UInt16 ns;
+    const char *name;
+    size_t len;
+} BrowsePathElement;
+
+/* Prefix tree of browse path elements, see resolveBrowsePaths() */
+#define BROWSE_ROOT 0xffffffff      // parent of the first elements: the Objects folder
+struct BrowseTreeKey {
+    OpcUa_UInt32 parent;            // index in the tree or BROWSE_ROOT
+    OpcUa_UInt16 ns;
+    std::string name;
+    bool operator<(const BrowseTreeKey &k) const {
+        if(parent != k.parent) return parent < k.parent;
+        if(ns != k.ns) return ns < k.ns;
+        return name < k.name;
+    }
+};
+struct BrowseTreeNode {
+    BrowseTreeKey key;
+    UaNodeId node;                  // null until resolved, or if the translation failed
+};
+
+/* Additional session to the same server, used for writes only. */
+class DevUaClient;
+class DevUaWriteSession : public UaSessionCallback
+{
+    UA_DISABLE_COPY(DevUaWriteSession);
+public:
+    DevUaWriteSession(DevUaClient *client)
+        : pClient(client)
+        , pSession(new UaSession())
+        , serverStatus(UaClient::Disconnected)
+        , writes(0)
+    {}
+    virtual ~DevUaWriteSession()
+    {
+        if (pSession->isConnected()) {
+            ServiceSettings serviceSettings;
+            pSession->disconnect(serviceSettings, OpcUa_True);
+        }
+        delete pSession;
+    }
+    virtual void connectionStatusChanged(OpcUa_UInt32 clientConnectionId, UaClient::ServerStatus status)
+    {
+        OpcUa_ReferenceParameter(clientConnectionId);
+        serverStatus = status;
+    }
+    virtual void writeComplete(OpcUa_UInt32 transactionId,const UaStatus& result,const UaStatusCodeArray& results,const UaDiagnosticInfos& diagnosticInfos);
+    bool isUsable() { return serverStatus == UaClient::Connected; }
+
+    DevUaClient *pClient;
+    UaSession *pSession;
+    UaClient::ServerStatus serverStatus;
+    unsigned long writes;
+    /* Per item: pre-built request of the out records of this session, see prepareWrites().
+     * Not registered nodes: the session may reconnect on its own. */
+    std::vector<UaWriteValues> vWriteRequest;
+};
 
 class DevUaClient : public UaSessionCallback
 {
@@ -127,6 +231,7 @@ public:
     virtual void connectionStatusChanged(OpcUa_UInt32 clientConnectionId, UaClient::ServerStatus serverStatus);
     // UaSessionCallback implementation ------------------------------------------------------
 
+    std::string name;           // session name
     UaString applicationCertificate;
     UaString applicationPrivateKey;
     UaString hostName;
@@ -136,18 +241,42 @@ public:
     UaStatus subscribe();
     UaStatus unsubscribe();
     void setBadQuality();
+    void propagateAlarms();
+    static void alarmWorker(void *arg);
 
     void addOPCUA_Item(OPCUA_ItemINFO *h);
     long getNodes();
-    long getBrowsePathItem(OpcUa_BrowsePath &browsePaths,std::string &ItemPath,const char nameSpaceDelim,const char pathDelimiter);
+    OpcUa_UInt32 retranslateCachedNodes(const std::vector<OpcUa_UInt32> &vIdx);
+    void recreateUnknownNodes();
+    UaStatus resolveBrowsePaths(const std::vector<OpcUa_UInt32> &vItems, std::vector<UaNodeId> &vNodes);
     UaStatus createMonitoredItems();
+    long setupMonitors();
+    void recoverSubscriptions(bool newSession);
+    double setupStep();
+    void requestMonitors();
+    bool setupPending();
+    void startSetup();
+    long startMonitors();
+    bool deferWrite(OPCUA_ItemINFO *uaItem);
+    void setMonitorsUp();
+    bool namespacesChanged();
 
     UaStatus readFunc(UaDataValues &values,ServiceSettings &serviceSettings,UaDiagnosticInfos &diagnosticInfos);
 
-    UaStatus writeFunc(ServiceSettings &serviceSettings,UaWriteValues &nodesToWrite,UaStatusCodeArray &results,UaDiagnosticInfos &diagnosticInfos);
-    void writeComplete(OpcUa_UInt32 transactionId,const UaStatus&result,const UaStatusCodeArray& results,const UaDiagnosticInfos& diagnosticInfos);
+    UaStatus writeFunc(const OPCUA_ItemINFO *uaItem,ServiceSettings &serviceSettings,UaWriteValues &nodesToWrite,UaStatusCodeArray &results,UaDiagnosticInfos &diagnosticInfos);
+    UaStatus queueWrite(OPCUA_ItemINFO *uaItem);
+    UaStatus queueWriteLocked(OPCUA_ItemINFO *uaItem, const void *pVal, bool *pFlush);
+    void flushWrites();
+    void freeTransaction(OpcUa_UInt32 transactionId);
+    void setWriteBatch(double window, OpcUa_UInt32 maxItems);
+    void readOperationLimits();
+    void prepareWrites();
+    void preparePolls();
+    void poll(DevUaPollGroup *pGroup);
+    virtual void writeComplete(OpcUa_UInt32 transactionId,const UaStatus&result,const UaStatusCodeArray& results,const UaDiagnosticInfos& diagnosticInfos);
 
     void itemStat(int v);
+    int itemTrace(const char *name, int on);
     void setDebug(int debug);
     int  getDebug();
 
@@ -158,48 +287,356 @@ private:
     int debug;
     int autoConnect;
     UaSession* m_pSession;
-    DevUaSubscription* m_pDevUaSubscription;
+    std::vector<DevUaWriteSession *> m_vWriteSession;   // pool of additional sessions for writes, see writeSessions
+    std::vector<DevUaSubscription *> m_vDevUaSubscription;  // one per subscription group, index = group
     UaClient::ServerStatus serverConnectionStatus;
     bool initialSubscriptionOver;
     autoSessionConnect *autoConnector;
+    double m_retryDelay;            // backoff of the background setup [sec], 0: no failure yet
+    volatile bool m_monitorsRequested;  // the IOC runs: set up the monitored items
+    volatile bool m_monitorsUp;         // setupMonitors() done
+    epicsMutexId m_setupLock;           // m_monitorsRequested vs. the end of the setup timer
+    bool m_setupRunning;                // the setup timer is started or in expire()
+    bool m_itemsCreated;                // createMonitoredItems() ran, a retry recreates the failed items only
+    double backoff();
     epicsTimerQueueActive &queue;
+    OpcUa_UInt32 maxNodesPerRead;           // OperationLimits of the server, 0: no limit
+    OpcUa_UInt32 maxNodesPerTranslate;
+    OpcUa_UInt32 maxMonitoredItemsPerCall;
+
+    void completeWrite(OPCUA_ItemINFO *uaItem, OpcUa_StatusCode code);
+    /* Write batching: writes within m_writeWindow are sent in one Write call of at most
+     * m_writeBatchMax and the servers MaxNodesPerWrite items. Protected by m_writeLock. */
+    epicsMutexId m_writeLock;
+    std::vector<PendingWrite> m_vPendingWrite;      // the first m_nPendingWrite entries are used
+    OpcUa_UInt32 m_nPendingWrite;
+    std::deque<WriteTransaction> m_vTransaction;    // outstanding Write calls, a deque keeps the references
+    std::vector<OpcUa_UInt32> m_vFreeTransaction;   // free slots of m_vTransaction
+    std::vector<UaWriteValues> m_vWriteRequest;     // per item: pre-built request of out records on the main session
+    int m_requestUsers;             // flushWrites() calls encoding a pre-built request
+    bool m_requestRebuild;          // prepareWrites() waits for m_requestUsers, don't use the pre-built requests
+    epicsEventId m_requestIdle;     // m_requestUsers dropped to 0
+    UaNodeIdArray m_registeredNodes;                // RegisterNodes result of the main session
+    std::vector<std::string> m_vNamespaces;         // NamespaceArray of the server at the last getNodes()
+    std::vector<bool> m_vFromCache;                 // per item: vUaNodeId is from the node cache
+    double m_writeWindow;                   // [sec], 0: no batching
+    OpcUa_UInt32 m_writeBatchMax;           // 0: no limit
+    OpcUa_UInt32 m_maxNodesPerWrite;        // of the server, 0: no limit
+    bool m_writeTimerRunning;
+    writeBatchTimer *m_pWriteTimer;
+    unsigned long m_writeCalls;
+    unsigned long m_writeItems;
+    /* Poll groups, on their own timer queue: a slow Read must not delay the writes */
+    std::vector<DevUaPollGroup *> m_vPollGroup;
+    epicsTimerQueueActive *m_pPollQueue;
+    /* Alarm worker: sets the records INVALID after a connection loss, see propagateAlarms() */
+    volatile bool m_connectionBad;          // set by setBadQuality(), cleared when connected again
+    volatile int m_alarmRun;
+    epicsEventId m_alarmEvent;
+    epicsEventId m_alarmExit;
+    CALLBACK m_alarmFence[NUM_CALLBACK_PRIORITIES];
+    epicsEventId m_alarmFenceDone[NUM_CALLBACK_PRIORITIES];
+    bool m_alarmFenceBusy[NUM_CALLBACK_PRIORITIES]; // the fence is queued, m_alarmFenceDone not taken yet
+    void waitCallbackQueues();
+    unsigned long m_alarmPasses;
+    unsigned long m_alarmRecords;
+    unsigned long m_alarmRetries;           // callbackRequest() failed, queue full
+    unsigned long m_alarmTimeouts;          // waitCallbackQueues() timed out
 };
 
-// Timer to retry connecting the session when the server is down at IOC startup
+/* Background setup of a session: connect, create the subscriptions and, once the IOC runs, set up
+ * the monitored items. Runs on the timer queue thread of the session, so neither drvOpcuaSetup()
+ * nor iocInit wait for the server. Failed steps are retried with exponential backoff.
+ */
 class autoSessionConnect : public epicsTimerNotify {
 public:
-    autoSessionConnect(DevUaClient *client, const double delay, epicsTimerQueueActive &queue)
+    autoSessionConnect(DevUaClient *client, epicsTimerQueueActive &queue)
         : timer(queue.createTimer())
         , client(client)
-        , delay(delay)
     {}
     virtual ~autoSessionConnect() { timer.destroy(); }
-    void start() { timer.start(*this, delay); }
+    void start(double delay = 0.0) { timer.start(*this, delay); }
+    virtual expireStatus expire(const epicsTime &/*currentTime*/);
+private:
+    epicsTimer &timer;
+    DevUaClient *client;
+};
+
+// Timer to send the writes collected within the batching window
+class writeBatchTimer : public epicsTimerNotify {
+public:
+    writeBatchTimer(DevUaClient *client, epicsTimerQueueActive &queue)
+        : timer(queue.createTimer())
+        , client(client)
+    {}
+    virtual ~writeBatchTimer() { timer.destroy(); }
+    void start(double delay) { timer.start(*this, delay); }
     virtual expireStatus expire(const epicsTime &/*currentTime*/) {
-        UaStatus result = client->connect();
-        if (result.isBad()) {
-            return expireStatus(restart, delay);
-        } else {
-            return expireStatus(noRestart);
-        }
+        client->flushWrites();
+        return expireStatus(noRestart);
     }
 private:
     epicsTimer &timer;
     DevUaClient *client;
-    const double delay;
 };
 
-void printVal(UaVariant &val,OpcUa_UInt32 IdxUaItemInfo);
+/* Poll group: the items of a session with the same link options poll=MS and maxage=MS.
+ * Read by one (chunked) Read call per period, see DevUaClient::poll().
+ */
+class DevUaPollGroup : public epicsTimerNotify {
+public:
+    DevUaPollGroup(DevUaClient *client, epicsTimerQueueActive &queue, double period, double maxAge)
+        : period(period)
+        , maxAge(maxAge)
+        , reads(0)
+        , overruns(0)
+        , failures(0)
+        , pNodes(new UaReadValueIds)
+        , pNextNodes(new UaReadValueIds)
+        , nextReady(false)
+        , lock(epicsMutexMustCreate())
+        , timer(queue.createTimer())
+        , client(client)
+    {}
+    virtual ~DevUaPollGroup() {
+        timer.destroy();
+        epicsMutexDestroy(lock);
+        delete pNodes;
+        delete pNextNodes;
+    }
+    void start() { timer.start(*this, 0.0); }
+    virtual expireStatus expire(const epicsTime &currentTime);
+
+    double period;                          // [sec]
+    double maxAge;                          // [ms]
+    std::vector<OPCUA_ItemINFO *> vItems;
+    std::vector<IOSCANPVT> vIoScan;         // scanned once after each read
+    unsigned long reads;
+    unsigned long overruns;                 // reads that took longer than the period
+    unsigned long failures;
+    UaReadValueIds *pNodes;                 // the items with a valid node, used by poll() only
+    std::vector<OPCUA_ItemINFO *> vRead;    // item of each entry of pNodes
+    UaReadValueIds *pNextNodes;             // set by preparePolls(), swapped in by the next poll()
+    std::vector<OPCUA_ItemINFO *> vNextRead;
+    bool nextReady;
+    epicsMutexId lock;                      // pNextNodes, vNextRead, nextReady
+private:
+    epicsTimer &timer;
+    DevUaClient *client;
+};
+
+void printVal(UaVariant &val,const OPCUA_ItemINFO *uaItem);
 void print_OpcUa_DataValue(_OpcUa_DataValue *d);
+static void alarmFenceCallback(CALLBACK *pcallback);
 
+/* Retry of the background setup: first after connectIntervalMin, doubled on each failure
+ * up to connectInterval [sec] */
 static double connectInterval = 10.0;
+static double connectIntervalMin = 1.0;
+/* Number of additional sessions to each server, used for writes. Set before drvOpcuaSetup() */
+static int writeSessions = 0;
+/* Browse path, read and monitored item services at connect: max. items per call (the servers
+ * OperationLimits may be lower, 0: server limit only) and max. calls in flight at once */
+static int serviceChunkSize = 1000;
+static int servicePipelineDepth = 4;
+/* Connection loss: records set INVALID per batch, the next batch waits for the callback queues */
+static int alarmBatchSize = 500;
 extern "C" {
     epicsExportAddress(double, connectInterval);
+    epicsExportAddress(double, connectIntervalMin);
+    epicsExportAddress(int, writeSessions);
+    epicsExportAddress(int, serviceChunkSize);
+    epicsExportAddress(int, servicePipelineDepth);
+    epicsExportAddress(int, alarmBatchSize);
+}
+
+/* Items per service call: serviceChunkSize or the lower limit of the server, 0: all items in one call */
+OpcUa_UInt32 serviceChunk(OpcUa_UInt32 serverLimit)
+{
+    OpcUa_UInt32 chunk = (serviceChunkSize > 0) ? serviceChunkSize : 0;
+    if(serverLimit && (!chunk || serverLimit < chunk))
+        chunk = serverLimit;
+    return chunk;
+}
+
+/* The chunks of runChunks() are done by a pool of servicePipelineDepth-1 threads, created at the
+ * first use and kept, and by the calling thread. Concurrent calls (setup, polls, recovery) share
+ * the pool, each call works on its own job too. chunkPoolQueue holds the jobs with chunks left.
+ */
+typedef struct {
+    DevUaChunkJob *job;
+    OpcUa_UInt32 nItems;
+    OpcUa_UInt32 chunk;
+    OpcUa_UInt32 next;          // first item of the next chunk
+    int running;                // chunks in progress
+    epicsEventId done;          // the last chunk is done
+} ChunkRunner;
+
+static epicsThreadOnceId chunkPoolOnce = EPICS_THREAD_ONCE_INIT;
+static epicsMutexId chunkPoolLock;
+static epicsEventId chunkPoolWork;
+static std::deque<ChunkRunner *> chunkPoolQueue;
+static int chunkPoolThreads;
+
+/* Take the next chunk of the job, chunkPoolLock is taken. Returns false if none is left */
+static bool takeChunk(ChunkRunner *pRunner, OpcUa_UInt32 *pFirst)
+{
+    if(pRunner->next >= pRunner->nItems)
+        return false;
+    *pFirst = pRunner->next;
+    pRunner->next += pRunner->chunk;
+    pRunner->running++;
+    if(pRunner->next >= pRunner->nItems) {
+        std::deque<ChunkRunner *>::iterator it = std::find(chunkPoolQueue.begin(), chunkPoolQueue.end(), pRunner);
+        if(it != chunkPoolQueue.end())
+            chunkPoolQueue.erase(it);
+    }
+    return true;
+}
+
+static void doChunk(ChunkRunner *pRunner, OpcUa_UInt32 first)
+{
+    pRunner->job->runChunk(first, std::min(pRunner->chunk, pRunner->nItems - first));
+    epicsMutexLock(chunkPoolLock);
+    bool last = (--pRunner->running == 0 && pRunner->next >= pRunner->nItems);
+    epicsMutexUnlock(chunkPoolLock);
+    if(last)
+        epicsEventSignal(pRunner->done);
+}
+
+static void chunkPoolWorker(void *arg)
+{
+    OpcUa_ReferenceParameter(arg);
+    while(1) {
+        epicsEventMustWait(chunkPoolWork);
+        epicsMutexLock(chunkPoolLock);
+        while(!chunkPoolQueue.empty()) {
+            ChunkRunner *pRunner = chunkPoolQueue.front();
+            OpcUa_UInt32 first = 0;
+            takeChunk(pRunner, &first);
+            if(!chunkPoolQueue.empty())
+                epicsEventSignal(chunkPoolWork);    // more work: wake the next thread
+            epicsMutexUnlock(chunkPoolLock);
+            doChunk(pRunner, first);
+            epicsMutexLock(chunkPoolLock);
+        }
+        epicsMutexUnlock(chunkPoolLock);
+    }
+}
+
+static void chunkPoolInit(void *arg)
+{
+    OpcUa_ReferenceParameter(arg);
+    chunkPoolLock = epicsMutexMustCreate();
+    chunkPoolWork = epicsEventMustCreate(epicsEventEmpty);
+    for(int i=1; i<servicePipelineDepth; i++) {
+        if(epicsThreadCreate("opcuaChunk", epicsThreadPriorityMedium,
+                             epicsThreadGetStackSize(epicsThreadStackMedium), chunkPoolWorker, NULL))
+            chunkPoolThreads++;
+    }
 }
 
+/* Run the job in chunks of chunk items, up to servicePipelineDepth calls in flight at once.
+ * The calling thread works on the job too. Returns when all chunks are done.
+ */
+void runChunks(DevUaChunkJob &job, OpcUa_UInt32 nItems, OpcUa_UInt32 chunk)
+{
+    ChunkRunner runner;
+    OpcUa_UInt32 first;
+    if(!chunk || chunk > nItems)
+        chunk = nItems;
+    if(!nItems)
+        return;
+    epicsThreadOnce(&chunkPoolOnce, chunkPoolInit, NULL);
+    if(chunkPoolThreads == 0 || chunk == nItems) {
+        for(first=0; first<nItems; first+=chunk)
+            job.runChunk(first, std::min(chunk, nItems - first));
+        return;
+    }
+    runner.job = &job;
+    runner.nItems = nItems;
+    runner.chunk = chunk;
+    runner.next = 0;
+    runner.running = 0;
+    runner.done = epicsEventMustCreate(epicsEventEmpty);
+    epicsMutexLock(chunkPoolLock);
+    chunkPoolQueue.push_back(&runner);
+    epicsMutexUnlock(chunkPoolLock);
+    epicsEventSignal(chunkPoolWork);
+
+    epicsMutexLock(chunkPoolLock);
+    while(takeChunk(&runner, &first)) {
+        epicsMutexUnlock(chunkPoolLock);
+        doChunk(&runner, first);
+        epicsMutexLock(chunkPoolLock);
+    }
+    epicsMutexUnlock(chunkPoolLock);
+    epicsEventMustWait(runner.done);     // signalled by the thread doing the last chunk
+    epicsEventDestroy(runner.done);
+}
+
+/* translateBrowsePathsToNodeIds of a part of the browse paths */
+class TranslateJob : public DevUaChunkJob {
+public:
+    TranslateJob(UaSession *pSession, UaBrowsePaths &paths, std::vector<UaNodeId> &nodes)
+        : m_pSession(pSession), m_paths(paths), m_nodes(nodes) {}
+    virtual void runChunk(OpcUa_UInt32 first, OpcUa_UInt32 count) {
+        ServiceSettings     serviceSettings;
+        UaBrowsePaths       part;
+        UaBrowsePathResults results;
+        UaDiagnosticInfos   diagnosticInfos;
+        part.attach(count, &m_paths[first]);    // no copy, detached again below
+        UaStatus result = m_pSession->translateBrowsePathsToNodeIds(serviceSettings, part, results, diagnosticInfos);
+        part.detach();
+        if(result.isBad()) {
+            setStatus(result.statusCode());
+            return;
+        }
+        for(OpcUa_UInt32 i=0; i<results.length() && i<count; i++)
+            if(OpcUa_IsGood(results[i].StatusCode) && results[i].NoOfTargets > 0)
+                m_nodes[first+i] = UaNodeId(results[i].Targets[0].TargetId.NodeId);
+    }
+private:
+    UaSession *m_pSession;
+    UaBrowsePaths &m_paths;
+    std::vector<UaNodeId> &m_nodes;
+};
+
+/* Read of a part of the nodes, maxAge [ms] 0: read from the device */
+class ReadJob : public DevUaChunkJob {
+public:
+    ReadJob(UaSession *pSession, UaReadValueIds &nodes, UaDataValues &values, double maxAge = 0.0)
+        : m_pSession(pSession), m_nodes(nodes), m_values(values), m_maxAge(maxAge) {}
+    virtual void runChunk(OpcUa_UInt32 first, OpcUa_UInt32 count) {
+        ServiceSettings     serviceSettings;
+        UaReadValueIds      part;
+        UaDataValues        results;
+        UaDiagnosticInfos   diagnosticInfos;
+        part.attach(count, &m_nodes[first]);
+        UaStatus result = m_pSession->read(serviceSettings, m_maxAge, OpcUa_TimestampsToReturn_Both, part, results, diagnosticInfos);
+        part.detach();
+        for(OpcUa_UInt32 i=0; i<count; i++) {
+            if(result.isBad() || i >= results.length())
+                m_values[first+i].StatusCode = result.isBad() ? result.statusCode() : (OpcUa_StatusCode) OpcUa_BadInternalError;
+            else
+                OpcUa_DataValue_CopyTo(&results[i], &m_values[first+i]);
+        }
+        if(result.isBad())
+            setStatus(result.statusCode());
+    }
+private:
+    UaSession *m_pSession;
+    UaReadValueIds &m_nodes;
+    UaDataValues &m_values;
+    double m_maxAge;
+};
+
 // global variables
 
-DevUaClient* pMyClient = NULL;
+/* Sessions, one for each drvOpcuaSetup(). Records select one by the link option session=NAME,
+ * default is the first session. The index is uaItem->session.
+ */
+static std::vector<DevUaClient *> vSessions;
 
 extern "C" {
                                     /* DRVSET */
@@ -218,7 +655,8 @@ extern "C" {
     epicsRegisterFunction(opcUa_io_report);
     long opcUa_io_report (int level) /* Write IO report output to stdout. */
     {
-        pMyClient->itemStat(level);
+        for(unsigned int i=0; i<vSessions.size(); i++)
+            vSessions[i]->itemStat(level);
         return 0;
     }
 }
@@ -227,18 +665,74 @@ DevUaClient::DevUaClient(int autoCon=1,int debug=0)
     : debug(debug)
     , serverConnectionStatus(UaClient::Disconnected)
     , initialSubscriptionOver(false)
+    , autoConnector(NULL)
     , queue (epicsTimerQueueActive::allocate(true))
+    , maxNodesPerRead(0)
+    , maxNodesPerTranslate(0)
+    , maxMonitoredItemsPerCall(0)
+    , m_nPendingWrite(0)
+    , m_requestUsers(0)
+    , m_requestRebuild(false)
+    , m_writeWindow(0.0)
+    , m_writeBatchMax(0)
+    , m_maxNodesPerWrite(0)
+    , m_writeTimerRunning(false)
+    , m_writeCalls(0)
+    , m_writeItems(0)
+    , m_pPollQueue(NULL)
+    , m_alarmPasses(0)
+    , m_alarmRecords(0)
+    , m_alarmRetries(0)
+    , m_alarmTimeouts(0)
 {
+    m_retryDelay          = 0.0;
+    m_monitorsRequested   = false;
+    m_monitorsUp          = false;
+    m_setupLock           = epicsMutexMustCreate();
+    m_setupRunning        = false;
+    m_itemsCreated        = false;
+    m_connectionBad       = false;
+    m_writeLock           = epicsMutexMustCreate();
+    m_requestIdle         = epicsEventMustCreate(epicsEventEmpty);
+    m_alarmEvent          = epicsEventMustCreate(epicsEventEmpty);
+    m_alarmExit           = epicsEventMustCreate(epicsEventEmpty);
+    for(int i=0; i<NUM_CALLBACK_PRIORITIES; i++) {
+        m_alarmFenceDone[i] = epicsEventMustCreate(epicsEventEmpty);
+        m_alarmFenceBusy[i] = false;
+        callbackSetCallback(alarmFenceCallback, &m_alarmFence[i]);
+        callbackSetPriority(i, &m_alarmFence[i]);
+        callbackSetUser(m_alarmFenceDone[i], &m_alarmFence[i]);
+    }
+    m_alarmRun            = 1;
+    epicsThreadMustCreate("opcUaAlarm", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          alarmWorker, this);
+    m_pWriteTimer         = new writeBatchTimer(this, queue);
     m_pSession            = new UaSession();
-    m_pDevUaSubscription  = new DevUaSubscription(getDebug());
+    for(int i=0; i<writeSessions; i++)
+        m_vWriteSession.push_back(new DevUaWriteSession(this));
+    std::vector<SubscriptionGroup> &groups = getSubscriptionGroups();
+    for(OpcUa_UInt32 i=0; i<groups.size(); i++)
+        m_vDevUaSubscription.push_back(new DevUaSubscription(getDebug(), i, groups[i]));
+    subscriptionGroupsFixed = true;
     autoConnect = autoCon;
     if(autoConnect)
-        autoConnector     = new autoSessionConnect(this, connectInterval, queue);
+        autoConnector     = new autoSessionConnect(this, queue);
 }
 
 DevUaClient::~DevUaClient()
 {
-    delete m_pDevUaSubscription;
+    m_alarmRun = 0;
+    epicsEventSignal(m_alarmEvent);
+    epicsEventMustWait(m_alarmExit);
+    for(unsigned int i=0; i<m_vPollGroup.size(); i++)
+        delete m_vPollGroup[i];
+    if(m_pPollQueue)
+        m_pPollQueue->release();
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++)
+        delete m_vDevUaSubscription[i];
+    for(unsigned int i=0; i<m_vWriteSession.size(); i++)
+        delete m_vWriteSession[i];
     if (m_pSession)
     {
         if (m_pSession->isConnected())
@@ -249,9 +743,17 @@ DevUaClient::~DevUaClient()
         delete m_pSession;
         m_pSession = NULL;
     }
-    queue.release();
     if(autoConnect)
         delete autoConnector;
+    delete m_pWriteTimer;
+    epicsMutexDestroy(m_writeLock);
+    epicsEventDestroy(m_requestIdle);
+    epicsMutexDestroy(m_setupLock);
+    epicsEventDestroy(m_alarmEvent);
+    epicsEventDestroy(m_alarmExit);
+    for(int i=0; i<NUM_CALLBACK_PRIORITIES; i++)
+        epicsEventDestroy(m_alarmFenceDone[i]);
+    queue.release();
 }
 
 void DevUaClient::connectionStatusChanged(
@@ -271,19 +773,19 @@ void DevUaClient::connectionStatusChanged(
     {
     case UaClient::ConnectionErrorApiReconnect:
     case UaClient::ServerShutdown:
-        this->setBadQuality();
-        this->unsubscribe();
-        break;
     case UaClient::ConnectionWarningWatchdogTimeout:
+        // Keep the subscriptions: the SDK reactivates the session or transfers them to a new one
         this->setBadQuality();
         break;
     case UaClient::Connected:
+        m_connectionBad = false;    // before the recovery: the alarm worker must not override it
         if(serverConnectionStatus == UaClient::ConnectionErrorApiReconnect
                 || serverConnectionStatus == UaClient::NewSessionCreated
+                || serverConnectionStatus == UaClient::ServerShutdown
+                || serverConnectionStatus == UaClient::ConnectionWarningWatchdogTimeout
                 || (serverConnectionStatus == UaClient::Disconnected && initialSubscriptionOver)) {
-            this->subscribe();
-            this->getNodes();
-            this->createMonitoredItems();
+            this->recoverSubscriptions(serverConnectionStatus != UaClient::ConnectionWarningWatchdogTimeout
+                                       && serverConnectionStatus != UaClient::ConnectionErrorApiReconnect);
         }
         break;
     case UaClient::Disconnected:
@@ -293,21 +795,244 @@ void DevUaClient::connectionStatusChanged(
     serverConnectionStatus = serverStatus;
 }
 
-// Set uaItem->stat = 1 if connectionStatusChanged() to bad connection
+epicsTimerNotify::expireStatus autoSessionConnect::expire(const epicsTime &/*currentTime*/)
+{
+    double delay = client->setupStep();
+    if(delay < 0.0 && !client->setupPending())
+        return expireStatus(noRestart);
+    return expireStatus(restart, delay < 0.0 ? 0.0 : delay);
+}
+
+/* One pass of the background setup. Return the delay until the next try [sec], <0: done.
+ * Broken links are not retried, only failures of the server.
+ */
+double DevUaClient::setupStep()
+{
+    if(!m_pSession->isConnected() && this->connect().isBad())
+        return backoff();
+    if(this->subscribe().isBad())
+        return backoff();
+    if(!m_monitorsRequested || m_monitorsUp)
+        return -1.0;            // requestMonitors() starts the next step
+    if(this->setupMonitors() < 0)
+        return backoff();
+    setMonitorsUp();
+    m_retryDelay = 0.0;
+    return -1.0;
+}
+
+/* Double the retry delay up to connectInterval. +-25% jitter: IOCs started at the same time
+ * don't hit the server at the same time again.
+ */
+double DevUaClient::backoff()
+{
+    m_retryDelay = (m_retryDelay > 0.0) ? 2.0 * m_retryDelay : connectIntervalMin;
+    if(m_retryDelay > connectInterval)
+        m_retryDelay = connectInterval;
+    double delay = m_retryDelay * (0.75 + 0.5 * rand() / (double) RAND_MAX);
+    if(debug) errlogPrintf("DevUaClient '%s': setup failed, retry in %.1f sec\n", name.c_str(), delay);
+    return delay;
+}
+
+/* drvOpcuaSetup: connect and subscribe in the background */
+void DevUaClient::startSetup()
+{
+    epicsMutexLock(m_setupLock);
+    m_setupRunning = true;
+    epicsMutexUnlock(m_setupLock);
+    autoConnector->start();
+}
+
+/* The IOC runs: set up the monitored items in the background. If the setup timer is
+ * running, its expire() sees the request in setupPending() and goes on.
+ */
+void DevUaClient::requestMonitors()
+{
+    epicsMutexLock(m_setupLock);
+    m_monitorsRequested = true;
+    bool idle = !m_setupRunning;
+    m_setupRunning = true;
+    epicsMutexUnlock(m_setupLock);
+    if(idle)
+        autoConnector->start();
+}
+
+/* setupStep() is done: true if the monitored items were requested meanwhile, else the setup timer stops */
+bool DevUaClient::setupPending()
+{
+    epicsMutexLock(m_setupLock);
+    bool pending = m_monitorsRequested && !m_monitorsUp;
+    if(!pending)
+        m_setupRunning = false;
+    epicsMutexUnlock(m_setupLock);
+    return pending;
+}
+
+/* Back after a connection loss. The SDK reactivated the session or, for a new session, transferred
+ * the subscriptions (TransferSubscriptions) and republishes the notifications missed meanwhile.
+ * Subscriptions that survived keep their monitored items: only items the server rejected before
+ * are created again and the records get their good status back. Subscriptions the server dropped
+ * (subscriptionStatusChanged) are created again with all their items. The node table is kept
+ * unless the server's NamespaceArray changed or it dropped a subscription, e.g. by a restart.
+ * Then the monitored items of surviving subscriptions whose node changed are created again.
+ */
+void DevUaClient::recoverSubscriptions(bool newSession)
+{
+    bool lost = false;
+    std::vector<UaNodeId> vOldNodeId;   // the nodes were translated again: recreate the changed items
+    if(!m_monitorsUp)       // not set up yet, done by the background setup
+        return;
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++)
+        if(m_vDevUaSubscription[i]->isLost())
+            lost = true;
+    if(debug) errlogPrintf("DevUaClient::recoverSubscriptions '%s': %s session, %s\n", name.c_str(),
+                           newSession ? "new" : "same", lost ? "subscriptions lost" : "subscriptions kept");
+    if(newSession || lost) {
+        this->readOperationLimits();
+        if(lost || namespacesChanged()) {
+            vOldNodeId = vUaNodeId;
+            this->getNodes();
+        }
+        this->prepareWrites();      // registered nodes belong to the old session
+        this->preparePolls();
+    }
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++) {
+        DevUaSubscription *pSub = m_vDevUaSubscription[i];
+        if(pSub->isLost()) {
+            pSub->deleteSubscription();
+            if(pSub->createSubscription(m_pSession).isGood())
+                pSub->createMonitoredItems(vUaNodeId,&vUaItemInfo,serviceChunk(maxMonitoredItemsPerCall));
+        }
+        else {
+            if(!vOldNodeId.empty())
+                pSub->recreateChangedItems(vOldNodeId,vUaNodeId,serviceChunk(maxMonitoredItemsPerCall));
+            pSub->recreateFailedItems(vUaNodeId,serviceChunk(maxMonitoredItemsPerCall));
+            pSub->restoreItems();
+        }
+    }
+    recreateUnknownNodes();
+}
+
+/* The namespace indexes of the server changed since getNodes(), the browse paths use them */
+bool DevUaClient::namespacesChanged()
+{
+    UaStringArray table = m_pSession->getNamespaceTable();
+    std::vector<std::string> namespaces;
+    for(OpcUa_UInt32 i=0; i<table.length(); i++)
+        namespaces.push_back(UaString(&table[i]).toUtf8());
+    return namespaces != m_vNamespaces;
+}
+
+// Set uaItem->stat = 1 if connectionStatusChanged() to bad connection, done by the alarm worker
 void DevUaClient::setBadQuality()
 {
-    epicsTimeStamp	 now;
+    m_connectionBad = true;
+    epicsEventSignal(m_alarmEvent);
+}
+
+void DevUaClient::alarmWorker(void *arg)
+{
+    DevUaClient *pClient = (DevUaClient *) arg;
+    while(pClient->m_alarmRun) {
+        epicsEventMustWait(pClient->m_alarmEvent);
+        // Before the setup the records are INVALID anyway, the item list may still grow
+        if(pClient->m_alarmRun && pClient->m_connectionBad && pClient->m_monitorsUp)
+            pClient->propagateAlarms();
+    }
+    epicsEventSignal(pClient->m_alarmExit);
+}
+
+/* Set the records INVALID and process them, in batches of alarmBatchSize records. Each record
+ * is changed under its lock. Records sharing an I/O scan list are scanned once. The next batch
+ * is queued only when the callback queues took the last one, so they don't overflow. Stop if the
+ * connection is back: recoverSubscriptions() restores the records set INVALID so far.
+ */
+void DevUaClient::propagateAlarms()
+{
+    epicsTimeStamp now;
+    std::set<IOSCANPVT> scanned;
+    OpcUa_UInt32 batch = (alarmBatchSize > 0) ? alarmBatchSize : vUaItemInfo.size();
     epicsTimeGetCurrent(&now);
+    m_alarmPasses++;
+
+    for(OpcUa_UInt32 first=0; first<vUaItemInfo.size() && m_connectionBad && m_alarmRun; first+=batch) {
+        OpcUa_UInt32 last = std::min(first + batch, (OpcUa_UInt32) vUaItemInfo.size());
+        bool queued = false;
+        for(OpcUa_UInt32 i=first; i<last; i++) {
+            OPCUA_ItemINFO *uaItem = vUaItemInfo[i];
+            dbScanLock(uaItem->prec);
+            epicsMutexLock(uaItem->flagLock);
+            bool bad = m_connectionBad;
+            if(bad) {
+                if(uaItem->prec->tse == epicsTimeEventDeviceTime)
+                    uaItem->prec->time = now;
+                uaItem->flagSuppressWrite = 1;
+                uaItem->echoPending = 0;    // the echos of the session are lost
+                if(!uaItem->stat)
+                    uaItem->connLost = 1;
+                uaItem->stat = 1;
+            }
+            epicsMutexUnlock(uaItem->flagLock);
+            dbScanUnlock(uaItem->prec);
+            if(!bad)
+                break;
+            m_alarmRecords++;
+            if(uaItem->inpDataType) { // is OUT Record
+                while(callbackRequest(&(uaItem->callback)) && m_alarmRun) {
+                    m_alarmRetries++;
+                    waitCallbackQueues();
+                }
+                queued = true;
+            }
+            else if(scanned.insert(uaItem->ioscanpvt).second) {
+                scanIoRequest(uaItem->ioscanpvt);
+                queued = true;
+            }
+        }
+        if(queued)
+            waitCallbackQueues();
+    }
+    if(debug) errlogPrintf("DevUaClient::propagateAlarms '%s': %s\n", name.c_str(),
+                           m_connectionBad ? "all records INVALID" : "connection back, stopped");
+}
 
-    for(OpcUa_UInt32 bpItem=0;bpItem<vUaItemInfo.size();bpItem++) {
-        OPCUA_ItemINFO *uaItem = vUaItemInfo[bpItem];
-        uaItem->prec->time = now;
-        uaItem->flagSuppressWrite = 1;
-        uaItem->stat = 1;
-        if(uaItem->inpDataType) // is OUT Record
-            callbackRequest(&(uaItem->callback));
+static void alarmFenceCallback(CALLBACK *pcallback)
+{
+    void *pDone;
+    callbackGetUser(pDone, pcallback);
+    epicsEventSignal((epicsEventId) pDone);
+}
+
+/* Queue a fence callback at each priority and wait until it ran: the callback queues took all
+ * requests queued before. Time out if the callback threads hang, the worker must not.
+ * A fence that timed out is still queued: it isn't queued again before it ran, and its late
+ * signal is taken then, so it can't end the wait for a later fence.
+ */
+void DevUaClient::waitCallbackQueues()
+{
+    bool queued[NUM_CALLBACK_PRIORITIES];
+    for(int i=0; i<NUM_CALLBACK_PRIORITIES; i++) {
+        queued[i] = false;
+        if(m_alarmFenceBusy[i]) {
+            if(epicsEventWaitWithTimeout(m_alarmFenceDone[i], 5.0) != epicsEventWaitOK) {
+                m_alarmTimeouts++;
+                continue;
+            }
+            m_alarmFenceBusy[i] = false;
+        }
+        int notQueued;
+        while((notQueued = callbackRequest(&m_alarmFence[i])) && m_alarmRun)
+            epicsThreadSleep(0.01);     // queue full
+        if(!notQueued)
+            queued[i] = m_alarmFenceBusy[i] = true;
+    }
+    for(int i=0; i<NUM_CALLBACK_PRIORITIES; i++) {
+        if(!queued[i])
+            continue;
+        if(epicsEventWaitWithTimeout(m_alarmFenceDone[i], 5.0) == epicsEventWaitOK)
+            m_alarmFenceBusy[i] = false;
         else
-            scanIoRequest( uaItem->ioscanpvt );
+            m_alarmTimeouts++;
     }
 }
 
@@ -322,7 +1047,8 @@ void DevUaClient::addOPCUA_Item(OPCUA_ItemINFO *h)
 
 void DevUaClient::setDebug(int d)
 {
-    m_pDevUaSubscription->debug = d;
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++)
+        m_vDevUaSubscription[i]->debug = d;
     this->debug = d;
 }
 
@@ -355,9 +1081,20 @@ UaStatus DevUaClient::connect()
         errlogPrintf("DevUaClient::connect() connection attempt failed with status %#8x (%s)\n",
                      result.statusCode(),
                      result.toString().toUtf8());
-        autoConnector->start();
+        return result;
     }
 
+    // The write sessions reconnect on their own once connected. If one fails, its writes use the main session
+    for(unsigned int i=0; i<m_vWriteSession.size(); i++) {
+        DevUaWriteSession *pWrite = m_vWriteSession[i];
+        if(pWrite->pSession->isConnected())
+            continue;
+        sessionConnectInfo.sSessionName = UaString("%1-w%2").arg(sessionConnectInfo.sApplicationUri).arg((int)i);
+        UaStatus status = pWrite->pSession->connect(url, sessionConnectInfo, sessionSecurityInfo, pWrite);
+        if (status.isBad())
+            errlogPrintf("DevUaClient::connect() write session %u connection attempt failed with status %#8x (%s)\n",
+                         i, status.statusCode(), status.toString().toUtf8());
+    }
     return result;
 }
 
@@ -369,6 +1106,9 @@ UaStatus DevUaClient::disconnect()
     ServiceSettings serviceSettings;
     char buf[30];
     if(debug) errlogPrintf("%s Disconnecting the session\n",getTime(buf));
+    for(unsigned int i=0; i<m_vWriteSession.size(); i++)
+        if(m_vWriteSession[i]->pSession->isConnected())
+            m_vWriteSession[i]->pSession->disconnect(serviceSettings,OpcUa_True);
     result = m_pSession->disconnect(serviceSettings,OpcUa_True);
 
     if (result.isBad())
@@ -383,80 +1123,186 @@ UaStatus DevUaClient::disconnect()
 
 UaStatus DevUaClient::subscribe()
 {
-    return m_pDevUaSubscription->createSubscription(m_pSession);
+    UaStatus result;
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++) {
+        if(!m_vDevUaSubscription[i]->isLost())     // created by an earlier call
+            continue;
+        UaStatus status = m_vDevUaSubscription[i]->createSubscription(m_pSession);
+        if(status.isBad())
+            result = status;
+    }
+    return result;
 }
 
 UaStatus DevUaClient::unsubscribe()
 {
-    return m_pDevUaSubscription->deleteSubscription();
+    UaStatus result;
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++) {
+        UaStatus status = m_vDevUaSubscription[i]->deleteSubscription();
+        if(status.isBad())
+            result = status;
+    }
+    return result;
 }
 
-void split(std::vector<std::string> &sOut,std::string &str, const char delimiter) {
-    std::stringstream ss(str); // Turn the string into a stream.
-    std::string tok;
+/* Split a link "tag,id" or "tag:path" at the delimiter after the tag [a-z0-9_-]+.
+ * Return the delimiter and set *pRest to the text after it, 0 if the link can't be parsed.
+ */
+static char parseLinkTag(const char *link, const char **pRest)
+{
+    const char *c = link;
+    while((*c >= 'a' && *c <= 'z') || (*c >= '0' && *c <= '9') || *c == '_' || *c == '-')
+        c++;
+    if(c == link || (*c != ',' && *c != ':'))
+        return 0;
+    *pRest = c + 1;
+    return *c;
+}
 
-    while(getline(ss, tok, delimiter)) {
-        sOut.push_back(tok);
+/* Parse an unsigned number of at most max up to the end char, return 0 on success */
+static long parseNumber(const char *str, char end, unsigned long max, unsigned long *pVal)
+{
+    const char *c = str;
+    unsigned long val = 0;
+    for(; *c >= '0' && *c <= '9'; c++) {
+        val = val*10 + (*c - '0');
+        if(val > max)
+            return 1;
     }
-
-    return;
+    if(c == str || *c != end)
+        return 1;
+    *pVal = val;
+    return 0;
 }
 
-long DevUaClient::getBrowsePathItem(OpcUa_BrowsePath &browsePaths,std::string &ItemPath,const char nameSpaceDelim,const char pathDelimiter)
+/* Parse the browse path "ns:name.name.ns:name" in place, the names point into path.
+ * An element without namespace uses the one of the element before, the first element
+ * must have a namespace, 0 is illegal. Return 0 on success.
+ */
+static long parseBrowsePath(const char *path, std::vector<BrowsePathElement> &elements)
 {
-    UaRelativePathElements  pathElements;
-    std::vector<std::string> devpath;
-    std::ostringstream ss;
-    boost::regex rex;
-    boost::cmatch matches;
-    ss <<"([0-9]+)"<< nameSpaceDelim <<"(.*)";
-    rex = ss.str();  // ="([a-z0-9_-]+)([,:])(.*)";
+    OpcUa_UInt16 ns = 0;
+    elements.clear();
+    for(;;) {
+        BrowsePathElement el;
+        const char *end = strchr(path, '.');
+        const char *colon;
+        unsigned long val;
+        if(!end)
+            end = path + strlen(path);
+        el.name = path;
+        colon = (const char *) memchr(path, ':', end - path);
+        if(colon && !parseNumber(path, ':', 0xffff, &val)) {
+            if(val == 0)        // namespace of 0 is illegal!
+                return 1;
+            ns = (OpcUa_UInt16) val;
+            el.name = colon + 1;
+        }
+        else if(!ns)            // first element must set namespace!
+            return 1;
+        el.ns = ns;
+        el.len = end - el.name;
+        elements.push_back(el);
+        if(!*end)
+            return 0;
+        path = end + 1;
+    }
+}
 
-    browsePaths.StartingNode.Identifier.Numeric = OpcUaId_ObjectsFolder;
+/* Resolve the browse paths of the items vItems by a prefix tree of the path elements:
+ * elements shared by several paths are translated once, each level of the tree is one
+ * translateBrowsePathsToNodeIds of single element paths, relative to the nodes of the
+ * level before. Paths that fail get a null node. vNodes is indexed by the item index.
+ */
+UaStatus DevUaClient::resolveBrowsePaths(const std::vector<OpcUa_UInt32> &vItems, std::vector<UaNodeId> &vNodes)
+{
+    std::vector<BrowseTreeNode> tree;
+    std::map<BrowseTreeKey, OpcUa_UInt32> children;
+    std::vector<std::vector<OpcUa_UInt32> > levels;
+    std::vector<OpcUa_UInt32> leaf(vItems.size());
+    std::vector<BrowsePathElement> elements;
+    UaStatus status;
+    OpcUa_UInt32 i, j;
+
+    for(i=0; i<vItems.size(); i++) {
+        OpcUa_UInt32 parent = BROWSE_ROOT;
+        parseBrowsePath(vUaItemInfo[vItems[i]]->ItemPath, elements);   // checked by getNodes()
+        for(j=0; j<elements.size(); j++) {
+            BrowseTreeKey key;
+            key.parent = parent;
+            key.ns = elements[j].ns;
+            key.name.assign(elements[j].name, elements[j].len);
+            std::map<BrowseTreeKey, OpcUa_UInt32>::iterator it = children.find(key);
+            if(it == children.end()) {
+                BrowseTreeNode node;
+                node.key = key;
+                tree.push_back(node);
+                it = children.insert(std::make_pair(key, (OpcUa_UInt32) tree.size()-1)).first;
+                if(levels.size() <= j)
+                    levels.resize(j+1);
+                levels[j].push_back(it->second);
+            }
+            parent = it->second;
+        }
+        leaf[i] = parent;
+    }
 
-    split(devpath,ItemPath,pathDelimiter);
-    pathElements.create(devpath.size());
-    
-    OpcUa_UInt16    nsIdx=0;
-    for(OpcUa_UInt32 i=0; i<devpath.size(); i++) {
-        std::string partPath = devpath[i];
-        std::string nsStr;
-        if (! boost::regex_match(partPath.c_str(), matches, rex) || (matches.size() != 3)) {
-            if(!nsIdx)    // first element must set namespace!
-                return 1;
-            //errlogPrintf("      p='%s'\n",partPath.c_str());
+    for(j=0; j<levels.size(); j++) {
+        std::vector<OpcUa_UInt32> vIdx;     // nodes of this level with a resolved parent
+        for(i=0; i<levels[j].size(); i++) {
+            OpcUa_UInt32 parent = tree[levels[j][i]].key.parent;
+            if(parent == BROWSE_ROOT || !tree[parent].node.isNull())
+                vIdx.push_back(levels[j][i]);
         }
-        else {
-            char         *endptr;
-            nsStr = matches[1];
-            partPath = matches[2];
-            nsIdx = strtol(nsStr.c_str(),&endptr,10); // regexp guarantees number
-            //errlogPrintf("  n=%d,p='%s'\n",nsIdx,partPath.c_str());
-            if(nsIdx == 0)     // namespace of 0 is illegal!
-                return 1;
+        if(vIdx.empty())
+            break;
+        UaBrowsePaths browsePaths;
+        std::vector<UaNodeId> vResult(vIdx.size());
+        browsePaths.create(vIdx.size());
+        for(i=0; i<vIdx.size(); i++) {
+            const BrowseTreeKey &key = tree[vIdx[i]].key;
+            UaRelativePathElements pathElements;
+            if(key.parent == BROWSE_ROOT)
+                UaNodeId(OpcUaId_ObjectsFolder).copyTo(&browsePaths[i].StartingNode);
+            else
+                tree[key.parent].node.copyTo(&browsePaths[i].StartingNode);
+            pathElements.create(1);
+            pathElements[0].IncludeSubtypes = OpcUa_True;
+            pathElements[0].IsInverse       = OpcUa_False;
+            pathElements[0].ReferenceTypeId.Identifier.Numeric = OpcUaId_HierarchicalReferences;
+            OpcUa_String_AttachCopy(&pathElements[0].TargetName.Name, key.name.c_str());
+            pathElements[0].TargetName.NamespaceIndex = key.ns;
+            browsePaths[i].RelativePath.NoOfElements = pathElements.length();
+            browsePaths[i].RelativePath.Elements = pathElements.detach();
         }
-        pathElements[i].IncludeSubtypes = OpcUa_True;
-        pathElements[i].IsInverse       = OpcUa_False;
-        pathElements[i].ReferenceTypeId.Identifier.Numeric = OpcUaId_HierarchicalReferences;
-        OpcUa_String_AttachCopy(&pathElements[i].TargetName.Name, partPath.c_str());
-        pathElements[i].TargetName.NamespaceIndex = nsIdx;
-    }
-    browsePaths.RelativePath.NoOfElements = pathElements.length();
-    browsePaths.RelativePath.Elements = pathElements.detach();
-    return 0;
+        // Translate in chunks of the servers limit
+        TranslateJob job(m_pSession, browsePaths, vResult);
+        runChunks(job, vIdx.size(), serviceChunk(maxNodesPerTranslate));
+        if(OpcUa_IsBad(job.status))
+            status = job.status;
+        for(i=0; i<vIdx.size(); i++)
+            tree[vIdx[i]].node = vResult[i];
+        if(debug>=2) errlogPrintf("resolveBrowsePaths level %u: %u elements stat=%s\n",
+                                  j+1, (unsigned int) vIdx.size(), UaStatus(job.status).toString().toUtf8());
+    }
+
+    for(i=0; i<vItems.size(); i++)
+        vNodes[vItems[i]] = tree[leaf[i]].node;
+    return status;
 }
 
 /* clear vUaNodeId and recreate all nodes from uaItem->ItemPath data.
  *    vUaItemInfo:  input link is either
  *    NODE_ID    or      BROWSEPATH
  *       |                   |
- *    getNodeId          getBrowsePathItem()
+ *    getNodeId          parseBrowsePath()
  *       |                   |
- *       |               translateBrowsePathsToNodeIds()
+ *       |               node cache, resolveBrowsePaths()
  *       |                   |
  *    vUaNodeId holds all nodes.
  * Index of vUaItemInfo has to match index of vUaNodeId to get record
  * access in DevUaSubscription::dataChange callback!
+ * Return 1 for illegal links, -1 if the translate service failed.
  */
 long DevUaClient::getNodes()
 {
@@ -469,44 +1315,30 @@ long DevUaClient::getNodes()
     char delim;
     char isNodeIdDelim = ',';
     char isNameSpaceDelim = ':';
-    char pathDelim = '.';
     UaStatus status;
-    UaDiagnosticInfos       diagnosticInfos;
-    ServiceSettings         serviceSettings;
-    UaBrowsePathResults     browsePathResults;
-    UaBrowsePaths           browsePaths;
-
-    std::ostringstream ss;
-    boost::regex rex;
-    boost::cmatch matches;
+    std::vector<BrowsePathElement> elements;    // reused, no allocation per item
 
-    ss <<"([a-z0-9_-]+)(["<< isNodeIdDelim << isNameSpaceDelim<<"])(.*)";
-    rex = ss.str();  // ="([a-z0-9_-]+)([,:])(.*)";
     vUaNodeId.clear();
+    m_vFromCache.assign(nrOfItems, false);
+    UaStringArray namespaceTable = m_pSession->getNamespaceTable();
+    m_vNamespaces.clear();
+    for(i=0; i<namespaceTable.length(); i++)
+        m_vNamespaces.push_back(UaString(&namespaceTable[i]).toUtf8());
 
-    browsePaths.create(nrOfItems);
     for(i=0;i<nrOfItems;i++) {
         OPCUA_ItemINFO        *uaItem = vUaItemInfo[i];
-        std::string ItemPath = uaItem->ItemPath;
-        int  ns;    // namespace
+        const char  *ItemPath = uaItem->ItemPath;
+        const char  *path;
+        unsigned long ns;    // namespace
         UaNodeId    tempNode;
-        if (! boost::regex_match( uaItem->ItemPath, matches, rex) || (matches.size() != 4)) {
-            errlogPrintf("%s getNodes() SKIP for bad link. Can't parse '%s'\n",uaItem->prec->name,ItemPath.c_str());
+        delim = parseLinkTag(ItemPath, &path);
+        if (!delim) {
+            errlogPrintf("%s getNodes() SKIP for bad link. Can't parse '%s'\n",uaItem->prec->name,ItemPath);
             ret=1;
             continue;
         }
-        delim = ((std::string)matches[2]).c_str()[0];
-        std::string path = matches[3];
-
-        int isStr=0;
-        try {
-            ns = boost::lexical_cast<int>(matches[1]);
-        }
-        catch (const boost::bad_lexical_cast &exc) {
-            isStr=1;
-        }
-        if( isStr ) {      // later versions: string tag to specify a subscription group
-            errlogPrintf("%s getNodes() SKIP for bad link. Illegal string type namespace tag in '%s'\n",uaItem->prec->name,ItemPath.c_str());
+        if(parseNumber(ItemPath, delim, 0xffff, &ns)) {      // later versions: string tag to specify a subscription group
+            errlogPrintf("%s getNodes() SKIP for bad link. Illegal string type namespace tag in '%s'\n",uaItem->prec->name,ItemPath);
             ret=1;
             continue;
         }
@@ -520,8 +1352,8 @@ long DevUaClient::getNodes()
                 ret = 1;
                 continue;
             }
-           if(getBrowsePathItem( browsePaths[nrOfBrowsePathItems],ItemPath,isNameSpaceDelim,pathDelim)){  // ItemPath: 'namespace:path' may include other namespaces within the path
-                if(debug) errlogPrintf("%s SKIP for bad link: Illegal or Missing namespace in '%s'\n",uaItem->prec->name,ItemPath.c_str());
+           if(parseBrowsePath(ItemPath, elements)){  // ItemPath: 'namespace:path' may include other namespaces within the path
+                if(debug) errlogPrintf("%s SKIP for bad link: Illegal or Missing namespace in '%s'\n",uaItem->prec->name,ItemPath);
                 ret = 1;
                 continue;
             }
@@ -537,19 +1369,19 @@ long DevUaClient::getNodes()
             OpcUa_UInt32 itemId;
             char         *endptr;
 
-            itemId = (OpcUa_UInt32) strtol(path.c_str(), &endptr, 10);
+            itemId = (OpcUa_UInt32) strtol(path, &endptr, 10);
             if(endptr == NULL) { // numerical id
-                tempNode.setNodeId( itemId, ns);
+                tempNode.setNodeId( itemId, (OpcUa_UInt16) ns);
             }
             else {                 // string id
-                tempNode.setNodeId(UaString(path.c_str()), ns);
+                tempNode.setNodeId(UaString(path), (OpcUa_UInt16) ns);
             }
             if(debug>2) errlogPrintf("%3u %s\tNODE: '%s'\n",i,uaItem->prec->name,tempNode.toString().toUtf8());
             vUaNodeId.push_back(tempNode);
             vReadNodeIds.push_back(tempNode);
         }
         else {
-            errlogPrintf("%s SKIP for bad link: '%s' unknown delimiter\n",uaItem->prec->name,ItemPath.c_str());
+            errlogPrintf("%s SKIP for bad link: '%s' unknown delimiter\n",uaItem->prec->name,ItemPath);
             ret = 1;
             continue;
         }
@@ -558,55 +1390,635 @@ long DevUaClient::getNodes()
         return ret;
 
     if(nrOfBrowsePathItems) {
-        browsePaths.resize(nrOfBrowsePathItems);
-        status = m_pSession->translateBrowsePathsToNodeIds(
-            serviceSettings, // Use default settings
-            browsePaths,
-            browsePathResults,
-            diagnosticInfos);
-
-        if(debug>=2) errlogPrintf("translateBrowsePathsToNodeIds stat=%d (%s). nrOfItems:%d\n",status.statusCode(),status.toString().toUtf8(),browsePathResults.length());
-        for(i=0; i<browsePathResults.length(); i++) {
-            UaNodeId tempNode;
-            if ( OpcUa_IsGood(browsePathResults[i].StatusCode) ) {
-                tempNode = UaNodeId(browsePathResults[i].Targets[0].TargetId.NodeId);
-                vUaNodeId.push_back(tempNode);
+        // Browse path links only: index of the browse path = index of vUaItemInfo
+        std::vector<UaNodeId> vNodes(nrOfBrowsePathItems);
+        std::vector<OpcUa_UInt32> vTranslate;   // paths not found in the node cache
+        if(nodeCacheEnabled()) {
+            std::string server = url.toUtf8();
+            nodeCacheCheckNamespaces(server, namespaceTable);
+            // Used as they are, see retranslateCachedNodes()
+            for(i=0; i<nrOfBrowsePathItems; i++) {
+                if(nodeCacheGet(server, vUaItemInfo[i]->ItemPath, vNodes[i]))
+                    m_vFromCache[i] = true;
+                else
+                    vTranslate.push_back(i);
             }
-            else {
-                tempNode = UaNodeId();
-                vUaNodeId.push_back(tempNode);
+        }
+        else {
+            for(i=0; i<nrOfBrowsePathItems; i++)
+                vTranslate.push_back(i);
+        }
+
+        if(vTranslate.size()) {
+            status = resolveBrowsePaths(vTranslate, vNodes);
+            if(status.isBad())      // service failed, not single paths: worth a retry
+                ret = -1;
+            if(debug>=2) errlogPrintf("resolveBrowsePaths stat=%d (%s). nrOfItems:%u\n",status.statusCode(),status.toString().toUtf8(),(unsigned int)vTranslate.size());
+            if(nodeCacheEnabled()) {
+                for(i=0; i<vTranslate.size(); i++)
+                    if(!vNodes[vTranslate[i]].isNull())
+                        nodeCachePut(url.toUtf8(), vUaItemInfo[vTranslate[i]]->ItemPath, vNodes[vTranslate[i]]);
+                nodeCacheSave();
             }
-            if(debug>=2) errlogPrintf("Node: idx=%d node=%s\n",i,tempNode.toString().toUtf8());
+        }
+        if(debug) errlogPrintf("getNodes '%s': %u browse paths, %u translated\n",name.c_str(),nrOfBrowsePathItems,(unsigned int)vTranslate.size());
+        for(i=0; i<nrOfBrowsePathItems; i++) {
+            vUaNodeId.push_back(vNodes[i]);
+            if(debug>=2) errlogPrintf("Node: idx=%d node=%s\n",i,vNodes[i].toString().toUtf8());
         }
 
     }
     return ret;
 }
 
+/* Nodes from the node cache the server doesn't know (BadNodeIdUnknown or BadNodeIdInvalid of a Read
+ * or CreateMonitoredItems, vIdx: items with these results): drop them from the cache and translate
+ * the browse paths of all items with these nodes again. Returns the number of items changed.
+ */
+OpcUa_UInt32 DevUaClient::retranslateCachedNodes(const std::vector<OpcUa_UInt32> &vIdx)
+{
+    std::set<UaNodeId> stale;
+    std::vector<OpcUa_UInt32> vItems;
+    std::string server = url.toUtf8();
+    OpcUa_UInt32 i, n = 0;
+
+    for(i=0; i<vIdx.size(); i++)
+        if(vIdx[i] < m_vFromCache.size() && m_vFromCache[vIdx[i]])
+            stale.insert(vUaNodeId[vIdx[i]]);
+    if(stale.empty())
+        return 0;
+    for(i=0; i<vUaNodeId.size() && i<m_vFromCache.size(); i++) {
+        if(m_vFromCache[i] && stale.count(vUaNodeId[i])) {
+            if(debug) errlogPrintf("%s cached node %s is stale, translate '%s' again\n",
+                                   vUaItemInfo[i]->prec->name, vUaNodeId[i].toXmlString().toUtf8(), vUaItemInfo[i]->ItemPath);
+            nodeCacheRemove(server, vUaItemInfo[i]->ItemPath);
+            m_vFromCache[i] = false;
+            vItems.push_back(i);
+        }
+    }
+    std::vector<UaNodeId> vNodes(vUaNodeId);
+    resolveBrowsePaths(vItems, vNodes);
+    for(i=0; i<vItems.size(); i++) {
+        OpcUa_UInt32 idx = vItems[i];
+        if(vNodes[idx] != vUaNodeId[idx]) {
+            vUaNodeId[idx] = vNodes[idx];
+            n++;
+        }
+        if(!vNodes[idx].isNull())
+            nodeCachePut(server, vUaItemInfo[idx]->ItemPath, vNodes[idx]);
+    }
+    nodeCacheSave();
+    if(debug) errlogPrintf("retranslateCachedNodes '%s': %u stale items, %u changed\n",
+                           name.c_str(), (unsigned int) vItems.size(), n);
+    return n;
+}
+
+/* Monitored items rejected for a stale cached node: translate again and create them with the new nodes */
+void DevUaClient::recreateUnknownNodes()
+{
+    std::vector<OpcUa_UInt32> vIdx;
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++)
+        m_vDevUaSubscription[i]->unknownNodeItems(vIdx);
+    if(vIdx.empty() || !retranslateCachedNodes(vIdx))
+        return;
+    this->prepareWrites();
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++)
+        m_vDevUaSubscription[i]->recreateFailedItems(vUaNodeId,serviceChunk(maxMonitoredItemsPerCall));
+}
+
+/* A retry of the setup creates only the items a failed service call left out */
 UaStatus DevUaClient::createMonitoredItems()
 {
-    return m_pDevUaSubscription->createMonitoredItems(vUaNodeId,&vUaItemInfo);
+    UaStatus result;
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++) {
+        DevUaSubscription *pSub = m_vDevUaSubscription[i];
+        UaStatus status;
+        if(m_itemsCreated)
+            status = pSub->recreateFailedItems(vUaNodeId,serviceChunk(maxMonitoredItemsPerCall));
+        else
+            status = pSub->createMonitoredItems(vUaNodeId,&vUaItemInfo,serviceChunk(maxMonitoredItemsPerCall));
+        if(status.isBad())
+            result = status;
+    }
+    m_itemsCreated = true;
+    recreateUnknownNodes();
+    return result;
+}
+
+/* Writes of one item always use the same session of the pool, so they stay in order.
+ * Concurrent writes of different items run in parallel on different sessions.
+ */
+static DevUaWriteSession *selectWriteSession(std::vector<DevUaWriteSession *> &pool, const OPCUA_ItemINFO *uaItem)
+{
+    if(!pool.empty()) {
+        DevUaWriteSession *pWrite = pool[uaItem->itemIdx % pool.size()];
+        if(pWrite->isUsable()) {
+            pWrite->writes++;
+            return pWrite;
+        }
+    }
+    return NULL;    // use the main session
+}
+
+UaStatus DevUaClient::writeFunc(const OPCUA_ItemINFO *uaItem,ServiceSettings &serviceSettings,UaWriteValues &nodesToWrite,UaStatusCodeArray &results,UaDiagnosticInfos &diagnosticInfos)
+{
+    // Writes variable value synchronous to OPC server
+    DevUaWriteSession *pWrite = selectWriteSession(m_vWriteSession,uaItem);
+    return (pWrite ? pWrite->pSession : m_pSession)->write(serviceSettings,nodesToWrite,results,diagnosticInfos);
+}
+
+/* Writes variable values asynchronous to OPC server. The value is converted now, because the record
+ * may change it while it is PACT. The Write call is done at once or, with a batching window, by the
+ * timer together with the other writes of the window. writeComplete() is called for the transactionId.
+ * write=latest: if a write of the item is in flight, keep the value as pending value, a newer value
+ * replaces it. completeWrite() sends the pending value.
+ */
+UaStatus DevUaClient::queueWrite(OPCUA_ItemINFO *uaItem)
+{
+    UaStatus status;
+    bool flush = false;
+
+    epicsMutexLock(m_writeLock);
+    if(uaItem->coalesce && uaItem->writeInFlight) {
+        if(uaItem->writePending)
+            uaItem->writesCoalesced++;
+        if(uaItem->recDataType == epicsStringT || uaItem->recDataType == epicsOldStringT) {
+            strncpy(uaItem->pendingVal.cString, (const char *) uaItem->pRecVal, ANY_VAL_STRING_SIZE-1);
+            uaItem->pendingVal.cString[ANY_VAL_STRING_SIZE-1] = '\0';
+        }
+        else
+            memcpy(&uaItem->pendingVal, uaItem->pRecVal, epicsTypeSizes[uaItem->recDataType]);
+        uaItem->writePending = 1;
+    }
+    else {
+        status = queueWriteLocked(uaItem, uaItem->pRecVal, &flush);
+        if(status.isGood())
+            uaItem->writeInFlight = 1;
+    }
+    epicsMutexUnlock(m_writeLock);
+    if(flush)
+        flushWrites();
+    return status;
+}
+
+/* Convert the value and add it to the pending writes, m_writeLock is taken. *pFlush: send them now */
+UaStatus DevUaClient::queueWriteLocked(OPCUA_ItemINFO *uaItem, const void *pVal, bool *pFlush)
+{
+    OpcUa_Variant value;
+
+    OpcUa_Variant_Initialize(&value);
+    if(uaItem->writeConv(pVal, &value)) {
+        OpcUa_Variant_Clear(&value);
+        return OpcUa_BadOutOfRange;
+    }
+    // A dataChange with this value is the echo of the write, see DevUaSubscription::processItem()
+    OpcUa_Double d;
+    epicsMutexLock(uaItem->flagLock);
+    uaItem->echoPending++;
+    uaItem->echoNumeric = (value.ArrayType == OpcUa_VariantArrayType_Scalar && UaVariant(value).toDouble(d) == OpcUa_Good);
+    uaItem->echoVal = uaItem->echoNumeric ? d : 0.0;
+    epicsMutexUnlock(uaItem->flagLock);
+    if(m_nPendingWrite == m_vPendingWrite.size())
+        m_vPendingWrite.resize(m_nPendingWrite+1);
+    PendingWrite &pending = m_vPendingWrite[m_nPendingWrite++];
+    pending.uaItem = uaItem;
+    pending.value.attach(&value);
+
+    OpcUa_UInt32 maxItems = m_writeBatchMax;
+    if(m_maxNodesPerWrite && (!maxItems || m_maxNodesPerWrite < maxItems))
+        maxItems = m_maxNodesPerWrite;
+    *pFlush = (m_writeWindow <= 0.0) || (maxItems && m_nPendingWrite >= maxItems);
+    if(!*pFlush && !m_writeTimerRunning) {
+        m_writeTimerRunning = true;
+        m_pWriteTimer->start(m_writeWindow);
+    }
+    return OpcUa_Good;
+}
+
+/* Send the pending writes in one Write call. A single write uses the pre-built request of its item
+ * for the session it goes to. m_writeLock is released before the call: writers and writeComplete()
+ * don't wait while it is encoded and sent, the write sessions work in parallel. A pre-built request
+ * isn't used twice at once: the next write of its item waits for the answer of the server.
+ */
+void DevUaClient::flushWrites()
+{
+    ServiceSettings serviceSettings;
+    UaWriteValues nodesToWrite;
+    UaWriteValues *pRequest = &nodesToWrite;
+    OpcUa_UInt32 transactionId;
+
+    epicsMutexLock(m_writeLock);
+    m_writeTimerRunning = false;
+    if(m_nPendingWrite == 0) {
+        epicsMutexUnlock(m_writeLock);
+        return;
+    }
+    OPCUA_ItemINFO *pFirst = m_vPendingWrite[0].uaItem;
+    DevUaWriteSession *pWrite = selectWriteSession(m_vWriteSession, pFirst);
+    std::vector<UaWriteValues> &vRequest = pWrite ? pWrite->vWriteRequest : m_vWriteRequest;
+    OpcUa_UInt32 idx = pFirst->itemIdx;
+    bool preBuilt = m_nPendingWrite == 1 && !m_requestRebuild
+                    && idx < vRequest.size() && vRequest[idx].length() == 1;
+
+    if(m_vFreeTransaction.empty()) {
+        m_vFreeTransaction.push_back(m_vTransaction.size());
+        m_vTransaction.push_back(WriteTransaction());
+    }
+    transactionId = m_vFreeTransaction.back();
+    m_vFreeTransaction.pop_back();
+    WriteTransaction &items = m_vTransaction[transactionId];
+
+    if(preBuilt) {
+        m_requestUsers++;
+        pRequest = &vRequest[idx];
+        OpcUa_Variant_Clear(&(*pRequest)[0].Value.Value);
+        m_vPendingWrite[0].value.detach(&(*pRequest)[0].Value.Value);
+        items.push_back(pFirst);
+    }
+    else {
+        nodesToWrite.create(m_nPendingWrite);
+        for(OpcUa_UInt32 i=0; i<m_nPendingWrite; i++) {
+            OPCUA_ItemINFO *uaItem = m_vPendingWrite[i].uaItem;
+            if((OpcUa_UInt32)uaItem->itemIdx < vRequest.size() && vRequest[uaItem->itemIdx].length() == 1 && !m_requestRebuild)
+                UaNodeId(vRequest[uaItem->itemIdx][0].NodeId).copyTo(&nodesToWrite[i].NodeId);
+            else
+                vUaNodeId[uaItem->itemIdx].copyTo(&nodesToWrite[i].NodeId);
+            nodesToWrite[i].AttributeId = OpcUa_Attributes_Value;
+            m_vPendingWrite[i].value.detach(&nodesToWrite[i].Value.Value);
+            items.push_back(uaItem);
+        }
+    }
+    m_nPendingWrite = 0;
+    m_writeCalls++;
+    m_writeItems += items.size();
+
+    if(debug >= 2) errlogPrintf("DevUaClient::flushWrites '%s': write %lu items, transaction %u\n",
+                                name.c_str(), (unsigned long)items.size(), transactionId);
+    epicsMutexUnlock(m_writeLock);
+
+    UaStatus status = (pWrite ? pWrite->pSession : m_pSession)->beginWrite(serviceSettings,*pRequest,transactionId);
+    if(preBuilt) {
+        epicsMutexLock(m_writeLock);
+        if(--m_requestUsers == 0 && m_requestRebuild)
+            epicsEventSignal(m_requestIdle);
+        epicsMutexUnlock(m_writeLock);
+    }
+
+    if(status.isBad()) {
+        if(debug) errlogPrintf("DevUaClient::flushWrites '%s': UaSession::beginWrite failed [ret=%s]\n",
+                               name.c_str(), status.toString().toUtf8());
+        for(OpcUa_UInt32 i=0; i<items.size(); i++)
+            completeWrite(items[i], status.statusCode());
+        freeTransaction(transactionId);
+    }
+}
+
+/* The Write call is done, reuse its slot */
+void DevUaClient::freeTransaction(OpcUa_UInt32 transactionId)
+{
+    epicsMutexLock(m_writeLock);
+    m_vTransaction[transactionId].clear();
+    m_vFreeTransaction.push_back(transactionId);
+    epicsMutexUnlock(m_writeLock);
+}
+
+/* Pre-build the write request of each out record, for the main session and for its write session.
+ * On the main session the nodes are registered (RegisterNodes service), so the server may skip the
+ * lookup of the NodeId. Registered NodeIds are valid for this session only, call it after each (re)connect.
+ */
+void DevUaClient::prepareWrites()
+{
+    ServiceSettings serviceSettings;
+    UaNodeIdArray nodes;
+    UaNodeIdArray registered;
+    std::vector<OpcUa_UInt32> vIdx;
+
+    for(OpcUa_UInt32 i=0; i<vUaItemInfo.size(); i++)
+        if(vUaItemInfo[i]->inpDataType && i < vUaNodeId.size() && !vUaNodeId[i].isNull())
+            vIdx.push_back(i);
+
+    if(m_registeredNodes.length() > 0) {
+        m_pSession->unregisterNodes(serviceSettings, m_registeredNodes);
+        m_registeredNodes.clear();
+    }
+    if(!vIdx.empty()) {
+        nodes.create(vIdx.size());
+        for(OpcUa_UInt32 i=0; i<vIdx.size(); i++)
+            vUaNodeId[vIdx[i]].copyTo(&nodes[i]);
+        UaStatus status = m_pSession->registerNodes(serviceSettings, nodes, registered);
+        if(status.isBad() || registered.length() != vIdx.size()) {
+            if(debug) errlogPrintf("DevUaClient::prepareWrites '%s': RegisterNodes failed [%s], use the NodeIds\n",
+                                   name.c_str(), status.toString().toUtf8());
+            registered.clear();
+        }
+    }
+
+    // Wait until no pre-built request is encoded, new writes don't use them meanwhile
+    epicsMutexLock(m_writeLock);
+    m_requestRebuild = true;
+    while(m_requestUsers > 0) {
+        epicsMutexUnlock(m_writeLock);
+        epicsEventMustWait(m_requestIdle);
+        epicsMutexLock(m_writeLock);
+    }
+    m_vWriteRequest.clear();
+    m_vWriteRequest.resize(vUaItemInfo.size());
+    for(OpcUa_UInt32 w=0; w<m_vWriteSession.size(); w++) {
+        m_vWriteSession[w]->vWriteRequest.clear();
+        m_vWriteSession[w]->vWriteRequest.resize(vUaItemInfo.size());
+    }
+    for(OpcUa_UInt32 i=0; i<vIdx.size(); i++) {
+        UaWriteValues &request = m_vWriteRequest[vIdx[i]];
+        request.create(1);
+        if(registered.length() > 0)
+            UaNodeId(registered[i]).copyTo(&request[0].NodeId);
+        else
+            vUaNodeId[vIdx[i]].copyTo(&request[0].NodeId);
+        request[0].AttributeId = OpcUa_Attributes_Value;
+        if(!m_vWriteSession.empty()) {
+            UaWriteValues &sessionRequest = m_vWriteSession[vIdx[i] % m_vWriteSession.size()]->vWriteRequest[vIdx[i]];
+            sessionRequest.create(1);
+            vUaNodeId[vIdx[i]].copyTo(&sessionRequest[0].NodeId);
+            sessionRequest[0].AttributeId = OpcUa_Attributes_Value;
+        }
+    }
+    if(registered.length() > 0)
+        m_registeredNodes = registered;
+    m_requestRebuild = false;
+    epicsMutexUnlock(m_writeLock);
+    if(debug) errlogPrintf("DevUaClient::prepareWrites '%s': %lu out records, %u registered nodes\n",
+                           name.c_str(), (unsigned long)vIdx.size(), registered.length());
+}
+
+/* Build the Read requests of the poll groups from the node table. The first call creates the
+ * groups and starts to poll.
+ */
+void DevUaClient::preparePolls()
+{
+    bool start = false;
+    if(m_vPollGroup.empty()) {
+        for(OpcUa_UInt32 i=0; i<vUaItemInfo.size(); i++) {
+            OPCUA_ItemINFO *uaItem = vUaItemInfo[i];
+            if(uaItem->pollInterval <= 0)
+                continue;
+            DevUaPollGroup *pGroup = NULL;
+            for(unsigned int j=0; j<m_vPollGroup.size() && !pGroup; j++)
+                if(m_vPollGroup[j]->period == uaItem->pollInterval && m_vPollGroup[j]->maxAge == uaItem->maxAge)
+                    pGroup = m_vPollGroup[j];
+            if(!pGroup) {
+                if(!m_pPollQueue)
+                    m_pPollQueue = &epicsTimerQueueActive::allocate(false, epicsThreadPriorityMedium);
+                pGroup = new DevUaPollGroup(this, *m_pPollQueue, uaItem->pollInterval, uaItem->maxAge);
+                m_vPollGroup.push_back(pGroup);
+            }
+            pGroup->vItems.push_back(uaItem);
+            if(std::find(pGroup->vIoScan.begin(), pGroup->vIoScan.end(), uaItem->ioscanpvt) == pGroup->vIoScan.end())
+                pGroup->vIoScan.push_back(uaItem->ioscanpvt);
+        }
+        start = true;
+    }
+    for(unsigned int i=0; i<m_vPollGroup.size(); i++) {
+        DevUaPollGroup *pGroup = m_vPollGroup[i];
+        OpcUa_UInt32 n = 0;
+        epicsMutexLock(pGroup->lock);   // doesn't wait for a Read in progress, see poll()
+        UaReadValueIds &nodes = *pGroup->pNextNodes;
+        nodes.clear();
+        nodes.create(pGroup->vItems.size());
+        pGroup->vNextRead.clear();
+        for(unsigned int j=0; j<pGroup->vItems.size(); j++) {
+            OPCUA_ItemINFO *uaItem = pGroup->vItems[j];
+            if(vUaNodeId[uaItem->itemIdx].isNull())
+                continue;
+            nodes[n].AttributeId = OpcUa_Attributes_Value;
+            vUaNodeId[uaItem->itemIdx].copyTo(&nodes[n].NodeId);
+            pGroup->vNextRead.push_back(uaItem);
+            n++;
+        }
+        nodes.resize(n);
+        pGroup->nextReady = true;
+        epicsMutexUnlock(pGroup->lock);
+        if(start)
+            pGroup->start();
+    }
+    if(debug && !m_vPollGroup.empty())
+        errlogPrintf("DevUaClient::preparePolls '%s': %u poll groups\n", name.c_str(), (unsigned int) m_vPollGroup.size());
+}
+
+/* Keep the period: the time of the read is subtracted from the delay to the next one */
+epicsTimerNotify::expireStatus DevUaPollGroup::expire(const epicsTime &currentTime)
+{
+    client->poll(this);
+    double delay = period - (epicsTime::getCurrent() - currentTime);
+    if(delay < 0.0) {
+        overruns++;
+        delay = 0.0;
+    }
+    return expireStatus(restart, delay);
+}
+
+/* Poll groups: set value, status and timestamp of a record from the read result */
+static void processPolledValue(OPCUA_ItemINFO *uaItem, const OpcUa_DataValue &value, int debug)
+{
+    epicsMutexLock(uaItem->flagLock);
+    uaItem->connLost = 0;
+    if(OpcUa_IsBad(value.StatusCode)) {
+        TRACE(uaItem,traceBadStatus,0,&value.StatusCode);
+        if(debug || uaItem->debug >= 2)
+            errlogPrintf("%s poll FAILED with status %s\n", uaItem->prec->name, UaStatus(value.StatusCode).toString().toUtf8());
+        uaItem->stat = 1;
+    }
+    else {
+        TRACE(uaItem,traceDataChange,value.Value.Datatype | (value.Value.ArrayType ? TRACE_ARRAY : 0),&value.Value.Value);
+        if(uaItem->buffered)
+            uaItem->stat = appendSample(value,uaItem) ? 1 : 0;
+        else
+            uaItem->stat = setRecVal(value.Value,uaItem,maxDebug(debug,uaItem->debug)) ? 1 : 0;
+    }
+    if(uaItem->prec->tse == epicsTimeEventDeviceTime)
+        uaToEpicsTime(uaItem->tsSource ? value.SourceTimestamp : value.ServerTimestamp, &uaItem->prec->time);
+    epicsMutexUnlock(uaItem->flagLock);
+}
+
+/* Read the items of a poll group in chunks of the servers limit, then scan its records.
+ * The lock is held only to take over a new request of preparePolls(), not during the Read.
+ */
+void DevUaClient::poll(DevUaPollGroup *pGroup)
+{
+    if(!m_pSession->isConnected())
+        return;                 // setBadQuality() did set the alarms
+    epicsMutexLock(pGroup->lock);
+    if(pGroup->nextReady) {
+        std::swap(pGroup->pNodes, pGroup->pNextNodes);
+        pGroup->vRead.swap(pGroup->vNextRead);
+        pGroup->nextReady = false;
+    }
+    epicsMutexUnlock(pGroup->lock);
+    OpcUa_UInt32 n = pGroup->pNodes->length();
+    UaDataValues values;
+    values.create(n);
+    ReadJob job(m_pSession, *pGroup->pNodes, values, pGroup->maxAge);
+    if(n)
+        runChunks(job, n, serviceChunk(maxNodesPerRead));
+    pGroup->reads++;
+    if(OpcUa_IsBad(job.status)) {
+        pGroup->failures++;
+        if(debug) errlogPrintf("DevUaClient::poll '%s': Read failed with status %s\n", name.c_str(),
+                               UaStatus(job.status).toString().toUtf8());
+    }
+    for(OpcUa_UInt32 i=0; i<n; i++)
+        processPolledValue(pGroup->vRead[i], values[i], debug);
+    for(unsigned int i=0; i<pGroup->vIoScan.size(); i++)
+        scanIoRequest(pGroup->vIoScan[i]);
+}
+
+/* Set the batching window [sec] and the max. number of items of one Write call, 0: no limit */
+void DevUaClient::setWriteBatch(double window, OpcUa_UInt32 maxItems)
+{
+    epicsMutexLock(m_writeLock);
+    m_writeWindow = window;
+    m_writeBatchMax = maxItems;
+    epicsMutexUnlock(m_writeLock);
+    if(window <= 0.0)
+        flushWrites();
+}
+
+/* Read the limits of the server for one service call, 0: no limit */
+void DevUaClient::readOperationLimits()
+{
+    ServiceSettings     serviceSettings;
+    UaReadValueIds      nodeToRead;
+    UaDataValues        values;
+    UaDiagnosticInfos   diagnosticInfos;
+    const OpcUa_UInt32  limitIds[] = {
+        OpcUaId_Server_ServerCapabilities_OperationLimits_MaxNodesPerRead,
+        OpcUaId_Server_ServerCapabilities_OperationLimits_MaxNodesPerWrite,
+        OpcUaId_Server_ServerCapabilities_OperationLimits_MaxNodesPerTranslateBrowsePathsToNodeIds,
+        OpcUaId_Server_ServerCapabilities_OperationLimits_MaxMonitoredItemsPerCall };
+    OpcUa_UInt32        limits[4] = {0, 0, 0, 0};
+
+    nodeToRead.create(4);
+    for(OpcUa_UInt32 i=0; i<4; i++) {
+        nodeToRead[i].AttributeId = OpcUa_Attributes_Value;
+        UaNodeId(limitIds[i]).copyTo(&nodeToRead[i].NodeId);
+    }
+    UaStatus status = m_pSession->read(serviceSettings, 0, OpcUa_TimestampsToReturn_Neither, nodeToRead, values, diagnosticInfos);
+    for(OpcUa_UInt32 i=0; status.isGood() && i<values.length() && i<4; i++) {
+        if(OpcUa_IsBad(values[i].StatusCode) || UaVariant(values[i].Value).toUInt32(limits[i]) != OpcUa_Good)
+            limits[i] = 0;      // optional properties, not all servers have them
+    }
+    maxNodesPerRead = limits[0];
+    maxNodesPerTranslate = limits[2];
+    maxMonitoredItemsPerCall = limits[3];
+    epicsMutexLock(m_writeLock);
+    m_maxNodesPerWrite = limits[1];
+    epicsMutexUnlock(m_writeLock);
+    if(debug) errlogPrintf("DevUaClient::readOperationLimits '%s': MaxNodesPerRead %u, MaxNodesPerWrite %u, "
+                           "MaxNodesPerTranslateBrowsePathsToNodeIds %u, MaxMonitoredItemsPerCall %u\n",
+                           name.c_str(), limits[0], limits[1], limits[2], limits[3]);
+}
+
+/* Map the status of a write to the alarm of the record */
+static void writeStatusToAlarm(OpcUa_StatusCode code, int *pStat, int *pSevr)
+{
+    *pStat = menuAlarmStatNO_ALARM;
+    *pSevr = menuAlarmSevrNO_ALARM;
+    if(OpcUa_IsUncertain(code)) {
+        *pStat = menuAlarmStatWRITE;
+        *pSevr = menuAlarmSevrMINOR;
+    }
+    else if(OpcUa_IsBad(code)) {
+        *pSevr = menuAlarmSevrINVALID;
+        switch(code) {
+        case OpcUa_BadTimeout:
+        case OpcUa_BadRequestTimeout:
+            *pStat = menuAlarmStatTIMEOUT;
+            break;
+        case OpcUa_BadNotConnected:
+        case OpcUa_BadConnectionClosed:
+        case OpcUa_BadServerNotConnected:
+        case OpcUa_BadSessionClosed:
+        case OpcUa_BadSecureChannelClosed:
+        case OpcUa_BadNoCommunication:
+            *pStat = menuAlarmStatCOMM;
+            break;
+        case OpcUa_BadNotWritable:
+        case OpcUa_BadUserAccessDenied:
+            *pStat = menuAlarmStatWRITE_ACCESS;
+            break;
+        default:
+            *pStat = menuAlarmStatWRITE;
+            break;
+        }
+    }
 }
 
-UaStatus DevUaClient::writeFunc(ServiceSettings &serviceSettings,UaWriteValues &nodesToWrite,UaStatusCodeArray &results,UaDiagnosticInfos &diagnosticInfos)
+/* Asynchronous write done: set the alarm and finish the processing of the record */
+void DevUaClient::completeWrite(OPCUA_ItemINFO *uaItem, OpcUa_StatusCode code)
 {
-    // Writes variable value synchronous to OPC server
-    return m_pSession->write(serviceSettings,nodesToWrite,results,diagnosticInfos);
+    int writeSevr = uaItem->writeSevr;
+    writeStatusToAlarm(code, &uaItem->writeStat, &uaItem->writeSevr);
+    if(OpcUa_IsNotGood(code) && (debug || uaItem->debug))
+        errlogPrintf("%s\tDevUaClient::writeComplete: write failed [%s]\n", uaItem->prec->name, UaStatus(code).toString().toUtf8());
+    if(OpcUa_IsBad(code)) {     // no echo of this write
+        epicsMutexLock(uaItem->flagLock);
+        if(uaItem->echoPending > 0)
+            uaItem->echoPending--;
+        epicsMutexUnlock(uaItem->flagLock);
+    }
+    if(!uaItem->coalesce) {
+        callbackRequestProcessCallback(&uaItem->writeCallback, uaItem->prec->prio, uaItem->prec);
+        return;
+    }
 
-/*    // Writes variable values asynchronous to OPC server
-    OpcUa_UInt32         transactionId=0;
-    m_pSession->beginWrite(serviceSettings,nodesToWrite,transactionId);
-*/
+    // write=latest: send the pending value. The record is processed again only if the alarm changes
+    bool flush = false;
+    epicsMutexLock(m_writeLock);
+    uaItem->writeInFlight = 0;
+    if(uaItem->writePending) {
+        uaItem->writePending = 0;
+        if(queueWriteLocked(uaItem, &uaItem->pendingVal, &flush).isGood())
+            uaItem->writeInFlight = 1;
+    }
+    epicsMutexUnlock(m_writeLock);
+    if(flush)
+        flushWrites();
+    if(writeSevr != uaItem->writeSevr) {
+        epicsMutexLock(uaItem->flagLock);
+        bool request = !uaItem->flagSuppressWrite;  // else the processing is requested already
+        uaItem->flagSuppressWrite = 1;  // process to set the alarm only, don't write again
+        epicsMutexUnlock(uaItem->flagLock);
+        if(request)
+            callbackRequest(&(uaItem->callback));
+    }
 }
 
+/* Dispatch the results of one Write call to its records */
 void DevUaClient::writeComplete( OpcUa_UInt32 transactionId,const UaStatus& result,const UaStatusCodeArray& results,const UaDiagnosticInfos& diagnosticInfos)
 {
-    if(result.isBad() && debug) {
-        errlogPrintf("Bad Write Result: ");
-        for(unsigned int i=0;i<results.length();i++) {
-            errlogPrintf("%s \n",result.isBad()? result.toString().toUtf8():"ok");
+    WriteTransaction *pItems = NULL;
+    OpcUa_ReferenceParameter(diagnosticInfos);
+
+    // The slot stays in use until freeTransaction(), its items don't change meanwhile
+    epicsMutexLock(m_writeLock);
+    if(transactionId < m_vTransaction.size() && !m_vTransaction[transactionId].empty())
+        pItems = &m_vTransaction[transactionId];
+    epicsMutexUnlock(m_writeLock);
+    if(!pItems) {
+        errlogPrintf("DevUaClient::writeComplete: unknown transaction %u\n", transactionId);
+        return;
+    }
+    for(OpcUa_UInt32 i=0; i<pItems->size(); i++) {
+        OpcUa_StatusCode code = result.statusCode();
+        if(result.isGood())
+            code = (i < results.length()) ? results[i] : (OpcUa_StatusCode) OpcUa_BadInternalError;
+        completeWrite((*pItems)[i], code);
     }
+    freeTransaction(transactionId);
 }
+
+void DevUaWriteSession::writeComplete(OpcUa_UInt32 transactionId,const UaStatus& result,const UaStatusCodeArray& results,const UaDiagnosticInfos& diagnosticInfos)
+{
+    pClient->writeComplete(transactionId,result,results,diagnosticInfos);
 }
 
 UaStatus DevUaClient::readFunc(UaDataValues &values,ServiceSettings &serviceSettings,UaDiagnosticInfos &diagnosticInfos)
@@ -616,12 +2028,12 @@ UaStatus DevUaClient::readFunc(UaDataValues &values,ServiceSettings &serviceSett
     OpcUa_UInt32        i,j;
 
     if(debug>=2) errlogPrintf("CALL DevUaClient::readFunc()\n");
-    nodeToRead.create(pMyClient->vUaNodeId.size());
-    for (i=0,j=0; i <pMyClient->vUaNodeId.size(); i++ )
+    nodeToRead.create(vUaNodeId.size());
+    for (i=0,j=0; i <vUaNodeId.size(); i++ )
     {
         if ( !vUaNodeId[i].isNull() ) {
             nodeToRead[j].AttributeId = OpcUa_Attributes_Value;
-            (pMyClient->vUaNodeId[i]).copyTo(&(nodeToRead[j].NodeId)) ;
+            (vUaNodeId[i]).copyTo(&(nodeToRead[j].NodeId)) ;
             j++;
         }
         else if (debug){
@@ -629,13 +2041,11 @@ UaStatus DevUaClient::readFunc(UaDataValues &values,ServiceSettings &serviceSett
         }
     }
     nodeToRead.resize(j);
-    result = m_pSession->read(
-        serviceSettings,
-        0,
-        OpcUa_TimestampsToReturn_Both,
-        nodeToRead,
-        values,
-        diagnosticInfos);
+    // Read in chunks of the servers limit
+    values.create(j);
+    ReadJob job(m_pSession, nodeToRead, values);
+    runChunks(job, j, serviceChunk(maxNodesPerRead));
+    result = job.status;
     if(result.isBad() && debug) {
         errlogPrintf("FAILED: DevUaClient::readFunc()\n");
         if(diagnosticInfos.noOfStringTable() > 0) {
@@ -648,7 +2058,19 @@ UaStatus DevUaClient::readFunc(UaDataValues &values,ServiceSettings &serviceSett
 
 void DevUaClient::itemStat(int verb)
 {
-    errlogPrintf("OpcUa driver: Connected items: %lu\n", (unsigned long)vUaItemInfo.size());
+    errlogPrintf("OpcUa session '%s' %s: Connected items: %lu\n", name.c_str(), url.toUtf8(), (unsigned long)vUaItemInfo.size());
+    for(unsigned int i=0; i<m_vDevUaSubscription.size(); i++)
+        m_vDevUaSubscription[i]->queueStat();
+    for(unsigned int i=0; i<m_vPollGroup.size(); i++)
+        errlogPrintf("  poll %gms maxage %gms: %lu items, %lu reads, %lu overruns, %lu failed\n",
+                     m_vPollGroup[i]->period*1000.0, m_vPollGroup[i]->maxAge, (unsigned long) m_vPollGroup[i]->vItems.size(),
+                     m_vPollGroup[i]->reads, m_vPollGroup[i]->overruns, m_vPollGroup[i]->failures);
+    errlogPrintf("  connection alarms: %lu passes, %lu records, %lu queue full retries, %lu queue wait timeouts\n",
+                 m_alarmPasses, m_alarmRecords, m_alarmRetries, m_alarmTimeouts);
+    errlogPrintf("  writes: window %gms, %lu items in %lu calls\n", m_writeWindow*1000.0, m_writeItems, m_writeCalls);
+    for(unsigned int i=0; i<m_vWriteSession.size(); i++)
+        errlogPrintf("  write session %u: %s, %lu writes\n", i,
+                     serverStatusStrings(m_vWriteSession[i]->serverStatus), m_vWriteSession[i]->writes);
     if(verb>0) {
         if(verb==1) errlogPrintf("Only bad signals\n");
         errlogPrintf("idx record Name           epics Type         opcUa Type      Stat NS:PATH\n");
@@ -659,8 +2081,47 @@ void DevUaClient::itemStat(int verb)
                    uaItem->recDataType,epicsTypeNames[uaItem->recDataType],
                    uaItem->itemDataType,variantTypeStrings(uaItem->itemDataType),
                    uaItem->stat,uaItem->ItemPath );
+            if((verb>1) && uaItem->buffered)
+                errlogPrintf("    buffer: %lu samples dropped, NELM was full\n", uaItem->bufOverflows);
+            if((verb>1) && uaItem->coalesce)
+                errlogPrintf("    write=latest: %lu values replaced\n", uaItem->writesCoalesced);
+            if((verb>1) && (uaItem->outDeadband >= 0 || uaItem->minWriteInterval > 0))
+                errlogPrintf("    odeadband/minwrite: %lu writes suppressed, %lu deferred\n",
+                             uaItem->writesSuppressed, uaItem->writesDeferred);
+        }
+    }
+}
+
+/* Switch the binary trace for one record or all records (name "" or "*"), return the number of records */
+int DevUaClient::itemTrace(const char *name, int on)
+{
+    int n = 0;
+    int all = (!name || !*name || !strcmp(name,"*"));
+    for(unsigned int i=0;i< vUaItemInfo.size();i++) {
+        OPCUA_ItemINFO* uaItem = vUaItemInfo[i];
+        if(all || !strcmp(name,uaItem->prec->name)) {
+            opcUaTraceEnable(uaItem,on);
+            n++;
         }
     }
+    return n;
+}
+
+/* OPC UA DateTime is in 100ns ticks since 1601-01-01. Convert with integer arithmetic to keep the full resolution.
+ * A timestamp not sent by the server is 0: use the current time.
+ */
+#define UA_SECS_AT_EPICS_EPOCH ((OpcUa_UInt64)134774*86400 + POSIX_TIME_AT_EPICS_EPOCH)  /* 134774 days 1601..1970 */
+#define UA_TICKS_PER_SEC       10000000
+void uaToEpicsTime(const OpcUa_DateTime &dt, epicsTimeStamp *pTime)
+{
+    OpcUa_UInt64 ticks = ((OpcUa_UInt64)dt.dwHighDateTime << 32) | dt.dwLowDateTime;
+    OpcUa_UInt64 secs  = ticks / UA_TICKS_PER_SEC;
+    if(secs < UA_SECS_AT_EPICS_EPOCH) {
+        epicsTimeGetCurrent(pTime);
+        return;
+    }
+    pTime->secPastEpoch = (epicsUInt32)(secs - UA_SECS_AT_EPICS_EPOCH);
+    pTime->nsec         = (epicsUInt32)(ticks % UA_TICKS_PER_SEC) * 100;
 }
 
 /* Maximize debug level from driver-debug (active >=1) and record-debug (active >= 2)
@@ -673,59 +2134,126 @@ inline int maxDebug(int dbg,int recDbg) {
 }
 epicsRegisterFunction(maxDebug);
 
+/* Buffered waveform: append one sample of a scalar node, its value or timestamp.
+ * Samples that don't fit in the buffer until the next record processing are dropped.
+ */
+long appendSample(const OpcUa_DataValue &value, OPCUA_ItemINFO* uaItem)
+{
+    OpcUa_Double d;
+    void *toRec;
+
+    if(uaItem->bufCount >= uaItem->arraySize) {
+        uaItem->bufOverflows++;
+        return 0;
+    }
+    toRec = (char *) uaItem->pBuffer + uaItem->bufCount * epicsTypeSizes[uaItem->recDataType];
+    if(uaItem->buffered == BUFFER_TIME) {
+        epicsTimeStamp ts;
+        uaToEpicsTime(uaItem->tsSource ? value.SourceTimestamp : value.ServerTimestamp, &ts);
+        *(epicsFloat64 *) toRec = (epicsFloat64) ts.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH + ts.nsec * 1e-9;
+        uaItem->bufCount++;
+        return 0;
+    }
+    if(value.Value.ArrayType != OpcUa_VariantArrayType_Scalar || UaVariant(value.Value).toDouble(d) != OpcUa_Good)
+        return 1;
+    switch(uaItem->recDataType) {
+    case epicsInt8T:    *(epicsInt8 *)    toRec = (epicsInt8) d;    break;
+    case epicsUInt8T:   *(epicsUInt8 *)   toRec = (epicsUInt8) d;   break;
+    case epicsInt16T:   *(epicsInt16 *)   toRec = (epicsInt16) d;   break;
+    case epicsUInt16T:  *(epicsUInt16 *)  toRec = (epicsUInt16) d;  break;
+    case epicsInt32T:   *(epicsInt32 *)   toRec = (epicsInt32) d;   break;
+    case epicsUInt32T:  *(epicsUInt32 *)  toRec = (epicsUInt32) d;  break;
+    case epicsFloat32T: *(epicsFloat32 *) toRec = (epicsFloat32) d; break;
+    case epicsFloat64T: *(epicsFloat64 *) toRec = d;                break;
+    default: return 1;
+    }
+    uaItem->bufCount++;
+    return 0;
+}
+
+/* Return the payload of an array variant if its element type is the same as the
+ * records element type, so it can be copied directly. NULL: needs conversion.
+ */
+static const void *directArrayData(const OpcUa_Variant &val, epicsType recDataType)
+{
+    switch(val.Datatype) {
+    case OpcUaType_Boolean:
+    case OpcUaType_Byte:    if(recDataType == epicsUInt8T) return val.Value.Array.Value.ByteArray; break;
+    case OpcUaType_SByte:   if(recDataType == epicsInt8T) return val.Value.Array.Value.SByteArray; break;
+    case OpcUaType_Int16:   if(recDataType == epicsInt16T) return val.Value.Array.Value.Int16Array; break;
+    case OpcUaType_UInt16:  if(recDataType == epicsUInt16T || recDataType == epicsEnum16T) return val.Value.Array.Value.UInt16Array; break;
+    case OpcUaType_Int32:   if(recDataType == epicsInt32T) return val.Value.Array.Value.Int32Array; break;
+    case OpcUaType_UInt32:  if(recDataType == epicsUInt32T) return val.Value.Array.Value.UInt32Array; break;
+    case OpcUaType_Float:   if(recDataType == epicsFloat32T) return val.Value.Array.Value.FloatArray; break;
+    case OpcUaType_Double:  if(recDataType == epicsFloat64T) return val.Value.Array.Value.DoubleArray; break;
+    }
+    return NULL;
+}
+
 /* write variant value from opcua read or callback to - whatever is determined in uaItem*/
-long setRecVal(const UaVariant &val, OPCUA_ItemINFO* uaItem,int debug)
-{
-    if(val.isArray()){
-        UaByteArray   aByte;
-        UaInt16Array  aInt16;
-        UaUInt16Array aUInt16;
-        UaInt32Array  aInt32;
-        UaUInt32Array aUInt32;
-        UaFloatArray  aFloat;
-        UaDoubleArray aDouble;
-
-        if(val.arraySize() <= uaItem->arraySize) {
+long setRecVal(const OpcUa_Variant &variant, OPCUA_ItemINFO* uaItem,int debug)
+{
+    if(variant.ArrayType == OpcUa_VariantArrayType_Array){
+        OpcUa_Int32 len = variant.Value.Array.Length;
+        const void *pData;
+
+        if(len < 0)     // null array
+            len = 0;
+        if(len > uaItem->arraySize) {
+            if(debug >= 2) errlogPrintf("%s setRecVal() Error record arraysize %d < OpcItem Size %d\n", uaItem->prec->name,uaItem->arraySize,len);
+            return 1;
+        }
+        pData = directArrayData(variant, uaItem->recDataType);
+        if(pData) {     // same type: copy straight from the notification
+            memcpy(uaItem->pRecVal,pData,epicsTypeSizes[uaItem->recDataType]*len);
+        }
+        else {
+            UaVariant     val(variant);
+            UaByteArray   aByte;
+            UaInt16Array  aInt16;
+            UaUInt16Array aUInt16;
+            UaInt32Array  aInt32;
+            UaUInt32Array aUInt32;
+            UaFloatArray  aFloat;
+            UaDoubleArray aDouble;
+
             switch(uaItem->recDataType) {
             case epicsInt8T:
             case epicsUInt8T:
                 val.toByteArray( aByte);
-                memcpy(uaItem->pRecVal,aByte.data(),sizeof(epicsInt8)*uaItem->arraySize);
+                memcpy(uaItem->pRecVal,aByte.data(),sizeof(epicsInt8)*len);
                 break;
             case epicsInt16T:
                 val.toInt16Array( aInt16);
-                memcpy(uaItem->pRecVal,aInt16.rawData(),sizeof(epicsInt16)*uaItem->arraySize);
+                memcpy(uaItem->pRecVal,aInt16.rawData(),sizeof(epicsInt16)*len);
                 break;
             case epicsEnum16T:
             case epicsUInt16T:
                 val.toUInt16Array( aUInt16);
-                memcpy(uaItem->pRecVal,aUInt16.rawData(),sizeof(epicsUInt16)*uaItem->arraySize);
+                memcpy(uaItem->pRecVal,aUInt16.rawData(),sizeof(epicsUInt16)*len);
                 break;
             case epicsInt32T:
                 val.toInt32Array( aInt32);
-                memcpy(uaItem->pRecVal,aInt32.rawData(),sizeof(epicsInt32)*uaItem->arraySize);
+                memcpy(uaItem->pRecVal,aInt32.rawData(),sizeof(epicsInt32)*len);
                 break;
             case epicsUInt32T:
                 val.toUInt32Array( aUInt32);
-                memcpy(uaItem->pRecVal,aUInt32.rawData(),sizeof(epicsUInt32)*uaItem->arraySize);
+                memcpy(uaItem->pRecVal,aUInt32.rawData(),sizeof(epicsUInt32)*len);
                 break;
             case epicsFloat32T:
                 val.toFloatArray( aFloat);
-                memcpy(uaItem->pRecVal,aFloat.rawData(),sizeof(epicsFloat32)*uaItem->arraySize);
+                memcpy(uaItem->pRecVal,aFloat.rawData(),sizeof(epicsFloat32)*len);
                 break;
             case epicsFloat64T:
                 val.toDoubleArray( aDouble);
-                memcpy(uaItem->pRecVal,aDouble.rawData(),sizeof(epicsFloat64)*uaItem->arraySize);
+                memcpy(uaItem->pRecVal,aDouble.rawData(),sizeof(epicsFloat64)*len);
                 break;
             default:
                 if(debug >= 2) errlogPrintf("%s setRecVal(): Can't convert array data type\n",uaItem->prec->name);
                 return 1;
             }
         }
-        else {
-            if(debug >= 2) errlogPrintf("%s setRecVal() Error record arraysize %d < OpcItem Size %d\n", uaItem->prec->name,val.arraySize(),uaItem->arraySize);
-            return 1;
-        }
+        uaItem->arrayCount = len;
     }      // end array
     else { // is no array
         void *toRec; // destination of the data, VAL, RVAL field directly: OUT records ** OR **
@@ -740,6 +2268,11 @@ long setRecVal(const UaVariant &val, OPCUA_ItemINFO* uaItem,int debug)
             toRec = &(uaItem->varVal); // is IN Record
             dataType = uaItem->recDataType;
         }
+        // conversion plan for the expected type, debug output by the generic conversion below
+        if(uaItem->readConv && (variant.Datatype == uaItem->itemDataType) && (debug < 3))
+            return uaItem->readConv(&variant,toRec);
+
+        UaVariant val(variant);
 
         switch(dataType){
         case epicsInt8T:
@@ -793,6 +2326,187 @@ long setRecVal(const UaVariant &val, OPCUA_ItemINFO* uaItem,int debug)
     return 0;
 }
 
+/***************** Conversion plans ********************/
+
+/* Access to the scalar value of a variant for each OPC data type */
+#define OPCUA_SCALAR(NAME, TYPE, MEMBER) \
+    struct Opc##NAME { \
+        typedef TYPE type; \
+        static const OpcUa_BuiltInType id = OpcUaType_##NAME; \
+        static type get(const OpcUa_Variant *pVar) { return pVar->Value.MEMBER; } \
+        static void set(OpcUa_Variant *pVar, type v) { pVar->Value.MEMBER = v; } \
+    };
+OPCUA_SCALAR(Boolean, OpcUa_Boolean, Boolean)
+OPCUA_SCALAR(SByte,   OpcUa_SByte,   SByte)
+OPCUA_SCALAR(Byte,    OpcUa_Byte,    Byte)
+OPCUA_SCALAR(Int16,   OpcUa_Int16,   Int16)
+OPCUA_SCALAR(UInt16,  OpcUa_UInt16,  UInt16)
+OPCUA_SCALAR(Int32,   OpcUa_Int32,   Int32)
+OPCUA_SCALAR(UInt32,  OpcUa_UInt32,  UInt32)
+OPCUA_SCALAR(Int64,   OpcUa_Int64,   Int64)
+OPCUA_SCALAR(UInt64,  OpcUa_UInt64,  UInt64)
+OPCUA_SCALAR(Float,   OpcUa_Float,   Float)
+OPCUA_SCALAR(Double,  OpcUa_Double,  Double)
+#undef OPCUA_SCALAR
+
+/* Read plan: only used where the records type holds every value of the OPC type.
+ * Narrowing conversions are left to the range checks of the generic conversion.
+ */
+template<class OPC, typename REC>
+static long readScalar(const OpcUa_Variant *pVariant, void *toRec)
+{
+    *((REC*)toRec) = (REC) OPC::get(pVariant);
+    return 0;
+}
+
+template<typename REC>
+static OPCUA_ReadConv readPlan(int itemDataType)
+{
+    switch(itemDataType) {
+    case OpcUaType_Boolean: return readScalar<OpcBoolean,REC>;
+    case OpcUaType_SByte:   return readScalar<OpcSByte,REC>;
+    case OpcUaType_Byte:    return readScalar<OpcByte,REC>;
+    case OpcUaType_Int16:   return readScalar<OpcInt16,REC>;
+    case OpcUaType_UInt16:  return readScalar<OpcUInt16,REC>;
+    case OpcUaType_Int32:   return readScalar<OpcInt32,REC>;
+    case OpcUaType_UInt32:  return readScalar<OpcUInt32,REC>;
+    case OpcUaType_Int64:   return readScalar<OpcInt64,REC>;
+    case OpcUaType_UInt64:  return readScalar<OpcUInt64,REC>;
+    case OpcUaType_Float:   return readScalar<OpcFloat,REC>;
+    case OpcUaType_Double:  return readScalar<OpcDouble,REC>;
+    default:                return NULL;
+    }
+}
+
+static OPCUA_ReadConv readPlan(int itemDataType, epicsType recType)
+{
+    switch(recType) {
+    case epicsFloat64T:
+        return readPlan<epicsFloat64>(itemDataType);
+    case epicsInt32T:
+        switch(itemDataType) {
+        case OpcUaType_Boolean:
+        case OpcUaType_SByte:
+        case OpcUaType_Byte:
+        case OpcUaType_Int16:
+        case OpcUaType_UInt16:
+        case OpcUaType_Int32:   return readPlan<epicsInt32>(itemDataType);
+        }
+        break;
+    case epicsUInt32T:
+        switch(itemDataType) {
+        case OpcUaType_Boolean:
+        case OpcUaType_Byte:
+        case OpcUaType_UInt16:
+        case OpcUaType_UInt32:  return readPlan<epicsUInt32>(itemDataType);
+        }
+        break;
+    default:
+        break;
+    }
+    return NULL;
+}
+
+/* Write plan: convert the records value to exactly the OPC type of the node, so the server
+ * doesn't have to. Values out of range of the OPC type are rejected here.
+ */
+/* Integers: v is rounded already. The upper limit 2^digits is exact as double, (double) max
+ * would round up to it for 64 bit types. Floats: NaN and +-Inf are sent as they are.
+ */
+template<typename T>
+static bool inRange(double v)
+{
+    if(std::numeric_limits<T>::is_integer)
+        return (v >= (double)(std::numeric_limits<T>::min)()) && (v < ldexp(1.0, std::numeric_limits<T>::digits));
+    if(v != v || fabs(v) > (std::numeric_limits<double>::max)())
+        return true;
+    return fabs(v) <= (double)(std::numeric_limits<T>::max)();
+}
+
+template<class OPC, typename REC>
+static long writeScalar(const void *fromRec, OpcUa_Variant *pVariant)
+{
+    double v = (double) *((const REC*)fromRec);
+    if(std::numeric_limits<typename OPC::type>::is_integer && !std::numeric_limits<REC>::is_integer)
+        v = floor(v + 0.5);
+    if(!inRange<typename OPC::type>(v))
+        return 1;
+    OpcUa_Variant_Initialize(pVariant);
+    pVariant->Datatype = OPC::id;
+    OPC::set(pVariant, (typename OPC::type) v);
+    return 0;
+}
+
+template<typename REC>
+static long writeBoolean(const void *fromRec, OpcUa_Variant *pVariant)
+{
+    OpcUa_Variant_Initialize(pVariant);
+    pVariant->Datatype = OpcUaType_Boolean;
+    pVariant->Value.Boolean = ( *((const REC*)fromRec) != 0 ) ? OpcUa_True : OpcUa_False;
+    return 0;
+}
+
+static long writeString(const void *fromRec, OpcUa_Variant *pVariant)
+{
+    OpcUa_Variant_Initialize(pVariant);
+    pVariant->Datatype = OpcUaType_String;
+    return OpcUa_IsGood(OpcUa_String_AttachCopy(&pVariant->Value.String, (const OpcUa_CharA*)fromRec)) ? 0 : 1;
+}
+
+template<typename REC>
+static OPCUA_WriteConv writePlan(int itemDataType)
+{
+    switch(itemDataType) {
+    case OpcUaType_Boolean: return writeBoolean<REC>;
+    case OpcUaType_SByte:   return writeScalar<OpcSByte,REC>;
+    case OpcUaType_Byte:    return writeScalar<OpcByte,REC>;
+    case OpcUaType_Int16:   return writeScalar<OpcInt16,REC>;
+    case OpcUaType_UInt16:  return writeScalar<OpcUInt16,REC>;
+    case OpcUaType_Int32:   return writeScalar<OpcInt32,REC>;
+    case OpcUaType_UInt32:  return writeScalar<OpcUInt32,REC>;
+    case OpcUaType_Int64:   return writeScalar<OpcInt64,REC>;
+    case OpcUaType_UInt64:  return writeScalar<OpcUInt64,REC>;
+    case OpcUaType_Float:   return writeScalar<OpcFloat,REC>;
+    case OpcUaType_Double:  return writeScalar<OpcDouble,REC>;
+    default:                return NULL;
+    }
+}
+
+static OPCUA_WriteConv writePlan(int itemDataType, epicsType recType)
+{
+    switch(recType) {
+    case epicsInt32T:   return writePlan<epicsInt32>(itemDataType);
+    case epicsUInt32T:  return writePlan<epicsUInt32>(itemDataType);
+    case epicsFloat64T: return writePlan<epicsFloat64>(itemDataType);
+    case epicsStringT:
+    case epicsOldStringT:
+        if(itemDataType == OpcUaType_String)
+            return writeString;
+        break;
+    default:
+        break;
+    }
+    return NULL;
+}
+
+/* Setup the conversion plans of an item as soon as the server type is known */
+void setConversionPlan(OPCUA_ItemINFO* uaItem)
+{
+    if(uaItem->isArray) {
+        uaItem->readConv  = NULL;
+        uaItem->writeConv = NULL;
+        return;
+    }
+    if(uaItem->inpDataType) {   // OUT record
+        uaItem->readConv  = readPlan(uaItem->itemDataType, (epicsType)uaItem->inpDataType);
+        uaItem->writeConv = writePlan(uaItem->itemDataType, uaItem->recDataType);
+    }
+    else {
+        uaItem->readConv  = readPlan(uaItem->itemDataType, uaItem->recDataType);
+        uaItem->writeConv = NULL;
+    }
+}
+
 /***************** just for debug ********************/
 
 void print_OpcUa_DataValue(_OpcUa_DataValue *d)
@@ -811,22 +2525,22 @@ void print_OpcUa_DataValue(_OpcUa_DataValue *d)
 
 }
 
-void printVal(UaVariant &val,OpcUa_UInt32 IdxUaItemInfo)
+void printVal(UaVariant &val,const OPCUA_ItemINFO *uaItem)
 {
     int i;
     if(val.isArray()) {
         for(i=0;i<val.arraySize();i++) {
             if(UaVariant(val[i]).type() < OpcUaType_String)
-                errlogPrintf("%s[%d] %s\n",pMyClient->vUaItemInfo[IdxUaItemInfo]->ItemPath,i,UaVariant(val[i]).toString().toUtf8());
+                errlogPrintf("%s[%d] %s\n",uaItem->ItemPath,i,UaVariant(val[i]).toString().toUtf8());
             else
-                errlogPrintf("%s[%d] '%s'\n",pMyClient->vUaItemInfo[IdxUaItemInfo]->ItemPath,i,UaVariant(val[i]).toString().toUtf8());
+                errlogPrintf("%s[%d] '%s'\n",uaItem->ItemPath,i,UaVariant(val[i]).toString().toUtf8());
         }
     }
     else {
         if(val.type() < OpcUaType_String)
-            errlogPrintf("%s %s\n",pMyClient->vUaItemInfo[IdxUaItemInfo]->ItemPath, val.toString().toUtf8());
+            errlogPrintf("%s %s\n",uaItem->ItemPath, val.toString().toUtf8());
         else
-            errlogPrintf("%s '%s'\n",pMyClient->vUaItemInfo[IdxUaItemInfo]->ItemPath, val.toString().toUtf8());
+            errlogPrintf("%s '%s'\n",uaItem->ItemPath, val.toString().toUtf8());
     }
 }
 
@@ -836,7 +2550,10 @@ void printVal(UaVariant &val,OpcUa_UInt32 IdxUaItemInfo)
 long OpcReadValues(int verbose,int monitored)
     {
     UaStatus status;
-    int debugStat = pMyClient->getDebug();
+    if(vSessions.empty())
+        return 1;
+    DevUaClient *pClient = vSessions[0];
+    int debugStat = pClient->getDebug();
 
     ServiceSettings   serviceSettings;
     UaDataValues      values;
@@ -844,22 +2561,22 @@ long OpcReadValues(int verbose,int monitored)
 
     if(verbose){
         errlogPrintf("OpcReadValues\n");
-        pMyClient->setDebug(verbose);
+        pClient->setDebug(verbose);
     }
-    if(pMyClient->getNodes() ) {
-        pMyClient->setDebug(debugStat);
+    if(pClient->getNodes() ) {
+        pClient->setDebug(debugStat);
         return 1;
     }
-    status = pMyClient->readFunc(values,serviceSettings,diagnosticInfos );
+    status = pClient->readFunc(values,serviceSettings,diagnosticInfos );
     if (status.isGood()) {
         if(verbose) errlogPrintf("READ VALUES success: %i\n",values.length());
         for(OpcUa_UInt32 j=0;j<values.length();j++) {
-            OPCUA_ItemINFO* uaItem = pMyClient->vUaItemInfo[j];
+            OPCUA_ItemINFO* uaItem = pClient->vUaItemInfo[j];
 
             if (OpcUa_IsGood(values[j].StatusCode)) {
                 UaVariant val = values[j].Value;
                 if( val.isArray()) {
-                    printVal(val,j);
+                    printVal(val,uaItem);
                     if(monitored) {
                         errlogPrintf("Monitored Arrays not supported yet");
                         return 1;
@@ -883,7 +2600,7 @@ long OpcReadValues(int verbose,int monitored)
                     default:
                         errlogPrintf("OpcReadValues(): '%s' unsupported opc data type: '%s'", uaItem->prec->name, variantTypeStrings(uaItem->itemDataType));
                     }
-                    setRecVal(val,uaItem,4);
+                    setRecVal(values[j].Value,uaItem,4);
                 }
             }
             else {
@@ -897,15 +2614,18 @@ long OpcReadValues(int verbose,int monitored)
         return 1;
     }
     if(monitored) {
-        pMyClient->createMonitoredItems();
+        pClient->createMonitoredItems();
     }
-    pMyClient->setDebug(debugStat);
+    pClient->setDebug(debugStat);
     return 0;
 }
-/* Client: write one value. First setup items by setOPCUA_Item() function */
+/* Client: write one value of the first session. First setup items by setOPCUA_Item() function */
 long OpcWriteValue(int opcUaItemIndex,double val,int verbose)
 {
-    int debugStat = pMyClient->getDebug();
+    if(vSessions.empty())
+        return 1;
+    DevUaClient *pClient = vSessions[0];
+    int debugStat = pClient->getDebug();
     UaStatus            status;
     ServiceSettings     serviceSettings;    // Use default settings
     UaVariant         tempValue;
@@ -913,201 +2633,193 @@ long OpcWriteValue(int opcUaItemIndex,double val,int verbose)
     UaStatusCodeArray   results;            // Returns an array of status codes
     UaDiagnosticInfos   diagnosticInfos;    // Returns an array of diagnostic info
     OPCUA_ItemINFO* uaItem;
-    uaItem = (pMyClient->vUaItemInfo).at(opcUaItemIndex);
+    uaItem = (pClient->vUaItemInfo).at(opcUaItemIndex);
 
     if(verbose){
         errlogPrintf("OpcWriteValue(%d,%f)\nTRANSLATEBROWSEPATH\n",opcUaItemIndex,val);
-        pMyClient->setDebug(verbose);
+        pClient->setDebug(verbose);
     }
 
     nodesToWrite.create(1);
 //from OPCUA_ItemINFO:    UaNodeId temp1Node(uaItem->ItemPath,uaItem->NdIdx);
-    UaNodeId tempNode(pMyClient->vUaNodeId[uaItem->itemIdx]);
+    UaNodeId tempNode(pClient->vUaNodeId[uaItem->itemIdx]);
     tempNode.copyTo(&nodesToWrite[0].NodeId);
     nodesToWrite[0].AttributeId = OpcUa_Attributes_Value;
     tempValue.setDouble(val);
     tempValue.copyTo(&nodesToWrite[0].Value.Value);
 
     // Writes variable value synchronous to OPC server
-    status = pMyClient->writeFunc(serviceSettings,nodesToWrite,results,diagnosticInfos);
+    status = pClient->writeFunc(uaItem,serviceSettings,nodesToWrite,results,diagnosticInfos);
     if ( status.isBad() )
     {
         errlogPrintf("** Error: UaSession::write failed [ret=%s] **\n", status.toString().toUtf8());
-        pMyClient->setDebug(debugStat);
+        pClient->setDebug(debugStat);
         return 1;
     }
-    pMyClient->setDebug(debugStat);
+    pClient->setDebug(debugStat);
     return 0;
 }
-/* iocShell: record write func  */
+/* iocShell: record write func. Starts an asynchronous write, DevUaClient::writeComplete() processes the record again */
 extern "C" {
 epicsRegisterFunction(OpcUaWriteItems);
 }
 long OpcUaWriteItems(OPCUA_ItemINFO* uaItem)
 {
     UaStatus            status=0;
-    ServiceSettings     serviceSettings;    // Use default settings
-    UaVariant           tempValue;
-    UaWriteValues       nodesToWrite;       // Array of nodes to write
-    UaStatusCodeArray   results;            // Returns an array of status codes
-    UaDiagnosticInfos   diagnosticInfos;    // Returns an array of diagnostic info
-
-    nodesToWrite.create(1);
-//from OPCUA_ItemINFO:    UaNodeId temp1Node(uaItem->ItemPath,uaItem->NdIdx);
-    UaNodeId tempNode(pMyClient->vUaNodeId[uaItem->itemIdx]);
-    tempNode.copyTo(&nodesToWrite[0].NodeId);
-    nodesToWrite[0].AttributeId = OpcUa_Attributes_Value;
-
-    switch((int)uaItem->itemDataType){
-    case OpcUaType_Boolean:
-        switch(uaItem->recDataType){//REC_Datatype(EPICS_Datatype)
-        case epicsInt32T:
-        case epicsUInt32T:  if( 0 != *((epicsInt32*)(uaItem)->pRecVal) )
-                                tempValue.setBool(true);
-                            else
-                                tempValue.setBool(false);
-                            break;
-        case epicsFloat64T:  if( *((epicsFloat64*)(uaItem)->pRecVal) == 0.0 ) /* is this reasonable?? or better don't support double */
-                                tempValue.setBool(false);
-                            else
-                                tempValue.setBool(true);
-                            break;
-
-        default: return 1;
-        }
-        break;
-    case OpcUaType_SByte:
+    DevUaClient        *pClient = vSessions[uaItem->session];
 
-        switch(uaItem->recDataType){//REC_Datatype(EPICS_Datatype)
-        case epicsInt32T:   tempValue.setInt32( *((epicsInt32*)(uaItem)->pRecVal));break;
-        case epicsUInt32T:  tempValue.setUInt32(*((epicsUInt32*)(uaItem)->pRecVal));break;
-        case epicsFloat64T: tempValue.setDouble(*((epicsFloat64*)(uaItem)->pRecVal));break;
-        default: status = 1;
-        }
-        break;
-    case OpcUaType_Byte:
-        switch(uaItem->recDataType){//REC_Datatype(EPICS_Datatype)
-        case epicsInt32T:   tempValue.setInt32( *((epicsInt32*)(uaItem)->pRecVal));break;
-        case epicsUInt32T:  tempValue.setUInt32(*((epicsUInt32*)(uaItem)->pRecVal));break;
-        case epicsFloat64T: tempValue.setDouble(*((epicsFloat64*)(uaItem)->pRecVal));break;
-        default: status = 1;
-        }
-        break;
-    case OpcUaType_Int16:
-        switch(uaItem->recDataType){//REC_Datatype(EPICS_Datatype)
-        case epicsInt32T:   tempValue.setInt32( *((epicsInt32*)(uaItem)->pRecVal));break;
-        case epicsUInt32T:  tempValue.setUInt32(*((epicsUInt32*)(uaItem)->pRecVal));break;
-        case epicsFloat64T: tempValue.setDouble(*((epicsFloat64*)(uaItem)->pRecVal));break;
-        default: status = 1;
-        }
-        break;
-    case OpcUaType_UInt16:
-        switch(uaItem->recDataType){//REC_Datatype(EPICS_Datatype)
-        case epicsInt32T:   tempValue.setInt32( *((epicsInt32*)(uaItem)->pRecVal));break;
-        case epicsUInt32T:  tempValue.setUInt32(*((epicsUInt32*)(uaItem)->pRecVal));break;
-        case epicsFloat64T: tempValue.setDouble(*((epicsFloat64*)(uaItem)->pRecVal));break;
-        default: status = 1;
-        }
-        break;
-    case OpcUaType_Int32:
-        switch(uaItem->recDataType){//REC_Datatype(EPICS_Datatype)
-        case epicsInt32T:   tempValue.setInt32( *((epicsInt32*)(uaItem)->pRecVal));break;
-        case epicsUInt32T:  tempValue.setUInt32(*((epicsUInt32*)(uaItem)->pRecVal));break;
-        case epicsFloat64T: tempValue.setDouble(*((epicsFloat64*)(uaItem)->pRecVal));break;
-        default: status = 1;
-        }
-        break;
-    case OpcUaType_UInt32:
-        switch(uaItem->recDataType){//REC_Datatype(EPICS_Datatype)
-        case epicsInt32T:   tempValue.setInt32( *((epicsInt32*)(uaItem)->pRecVal));break;
-        case epicsUInt32T:  tempValue.setUInt32(*((epicsUInt32*)(uaItem)->pRecVal));break;
-        case epicsFloat64T: tempValue.setDouble(*((epicsFloat64*)(uaItem)->pRecVal));break;
-        default: status = 1;
-        }
-        break;
-    case OpcUaType_Float:
-        switch(uaItem->recDataType){//REC_Datatype(EPICS_Datatype)
-        case epicsInt32T:   tempValue.setInt32( *((epicsInt32*)(uaItem)->pRecVal));break;
-        case epicsUInt32T:  tempValue.setUInt32(*((epicsUInt32*)(uaItem)->pRecVal));break;
-        case epicsFloat64T: tempValue.setDouble(*((epicsFloat64*)(uaItem)->pRecVal));break;
-        default: status = 1;
-        }
-        break;
-    case OpcUaType_Double:
-        switch(uaItem->recDataType){//REC_Datatype(EPICS_Datatype)
-        case epicsInt32T:   tempValue.setInt32( *((epicsInt32*)(uaItem)->pRecVal));break;
-        case epicsUInt32T:  tempValue.setUInt32(*((epicsUInt32*)(uaItem)->pRecVal));break;
-        case epicsFloat64T: tempValue.setDouble(*((epicsFloat64*)(uaItem)->pRecVal));break;
-        default: status = 1;
-        }
-        break;
-    case OpcUaType_String:
-        if(uaItem->recDataType == epicsOldStringT) { /* stringin/outRecord definition of 'char val[40]' */
-            tempValue.setString(UaString((char*)uaItem->pRecVal));break;
-        }
-        break;
-    default:
-        if(pMyClient->getDebug()) errlogPrintf("%s\tOpcUaWriteItems: unsupported opc data type: '%s'", uaItem->prec->name, variantTypeStrings(uaItem->itemDataType));
-    }
-    if((status==1) && pMyClient->getDebug()) {
-        errlogPrintf("%s\tOpcUaWriteItems: unsupported record data type: '%s'\n",uaItem->prec->name,epicsTypeNames[uaItem->recDataType]);
+    if(!uaItem->writeConv && pClient->deferWrite(uaItem))
+        return OPCUA_WRITE_DEFERRED;
+    if(!uaItem->writeConv) {
+        if(pClient->getDebug()) errlogPrintf("%s\tOpcUaWriteItems: unsupported data types, record: '%s' opc: '%s'\n",uaItem->prec->name,
+                                               epicsTypeNames[uaItem->recDataType], variantTypeStrings(uaItem->itemDataType));
         return 1;
     }
-
-    tempValue.copyTo(&nodesToWrite[0].Value.Value);
-
-    status = pMyClient->writeFunc(serviceSettings,nodesToWrite,results,diagnosticInfos);
+    status = pClient->queueWrite(uaItem);
     if ( status.isBad()  )
     {
-        if(pMyClient->getDebug()) errlogPrintf("%s\tOpcUaWriteItems: UaSession::write failed [ret=%s] **\n",uaItem->prec->name,status.toString().toUtf8());
+        if(pClient->getDebug()) errlogPrintf("%s\tOpcUaWriteItems: value out of range for '%s'\n",uaItem->prec->name,variantTypeStrings(uaItem->itemDataType));
         return 1;
     }
     return 0;
 }
 
-/* iocShell: Read and setup uaItem Item data type, createMonitoredItems */
+/* iocShell: Read and setup uaItem Item data type, createMonitoredItems.
+ * Sessions with automatic connect do it in the background and return at once.
+ */
 extern "C" {
 epicsRegisterFunction(OpcUaSetupMonitors);
 }
 long OpcUaSetupMonitors(void)
+{
+    long ret = 0;
+    for(unsigned int i=0; i<vSessions.size(); i++)
+        if(vSessions[i]->startMonitors())
+            ret = 1;
+    return ret;
+}
+
+long DevUaClient::startMonitors()
+{
+    if(autoConnect) {
+        requestMonitors();
+        return 0;
+    }
+    if(setupMonitors())
+        return 1;
+    setMonitorsUp();
+    return 0;
+}
+
+/* Before the setup the data type of the server, so the write conversion, isn't known.
+ * Return true if the setup isn't done: the write is marked and sent by setMonitorsUp().
+ */
+bool DevUaClient::deferWrite(OPCUA_ItemINFO *uaItem)
+{
+    bool defer;
+    epicsMutexLock(m_writeLock);
+    defer = !m_monitorsUp;
+    if(defer) {
+        epicsMutexLock(uaItem->flagLock);
+        uaItem->setupWrite = 1;
+        epicsMutexUnlock(uaItem->flagLock);
+    }
+    epicsMutexUnlock(m_writeLock);
+    return defer;
+}
+
+/* The setup is done: process the records with a write deferred by deferWrite() again */
+void DevUaClient::setMonitorsUp()
+{
+    unsigned int n = 0;
+    epicsMutexLock(m_writeLock);
+    m_monitorsUp = true;
+    epicsMutexUnlock(m_writeLock);
+    for(OpcUa_UInt32 i=0; i<vUaItemInfo.size(); i++) {
+        OPCUA_ItemINFO *uaItem = vUaItemInfo[i];
+        bool request = false;
+        epicsMutexLock(uaItem->flagLock);
+        if(uaItem->setupWrite && !uaItem->writeDeferred) {
+            uaItem->writeDeferred = 1;
+            request = true;
+        }
+        epicsMutexUnlock(uaItem->flagLock);
+        if(request) {
+            callbackRequest(&(uaItem->deferCallback));
+            n++;
+        }
+    }
+    if(debug && n) errlogPrintf("DevUaClient '%s': %u writes done before the setup sent\n", name.c_str(), n);
+}
+
+/* Read and setup the item data types of this session, createMonitoredItems.
+ * Return 1 for illegal links, -1 if a service failed.
+ */
+long DevUaClient::setupMonitors()
 {
     UaStatus status;
     UaDataValues values;
     ServiceSettings     serviceSettings;
     UaDiagnosticInfos   diagnosticInfos;
 
-    if(pMyClient->getDebug()) errlogPrintf("OpcUaSetupMonitors Browsepath ok len = %d\n",(int)pMyClient->vUaNodeId.size());
+    if(debug) errlogPrintf("OpcUaSetupMonitors '%s' Browsepath ok len = %d\n",name.c_str(),(int)this->vUaNodeId.size());
 
-    if(pMyClient->getNodes() )
-        return 1;
-    status = pMyClient->readFunc(values, serviceSettings, diagnosticInfos);
-    if (status.isBad()) {
-        errlogPrintf("OpcUaSetupMonitors: READ VALUES failed with status %s\n", status.toString().toUtf8());
-        return -1;
+    this->readOperationLimits();
+    long ret = this->getNodes();
+    if(ret)
+        return ret;
+    this->prepareWrites();
+    // Nodes of the node cache are checked by this read: translate the stale ones again, read once more
+    for(int pass=0; ; pass++) {
+        std::vector<OpcUa_UInt32> vUnknown;
+        status = this->readFunc(values, serviceSettings, diagnosticInfos);
+        if (status.isBad()) {
+            errlogPrintf("OpcUaSetupMonitors: READ VALUES failed with status %s\n", status.toString().toUtf8());
+            return -1;
+        }
+        for(OpcUa_UInt32 i=0, j=0; i<vUaNodeId.size() && j<values.length(); i++) {
+            if(vUaNodeId[i].isNull())   // skipped by readFunc()
+                continue;
+            if(values[j].StatusCode == OpcUa_BadNodeIdUnknown || values[j].StatusCode == OpcUa_BadNodeIdInvalid)
+                vUnknown.push_back(i);
+            j++;
+        }
+        if(pass > 0 || vUnknown.empty() || !retranslateCachedNodes(vUnknown))
+            break;
+        this->prepareWrites();
     }
-    if(pMyClient->getDebug() > 1) errlogPrintf("OpcUaSetupMonitors READ of %d values returned ok\n", values.length());
-    for(OpcUa_UInt32 i=0; i<values.length(); i++) {
-        OPCUA_ItemINFO* uaItem = pMyClient->vUaItemInfo[i];
-        if (OpcUa_IsBad(values[i].StatusCode)) {
+    if(debug > 1) errlogPrintf("OpcUaSetupMonitors READ of %d values returned ok\n", values.length());
+    for(OpcUa_UInt32 i=0, j=0; i<vUaItemInfo.size() && j<values.length(); i++) {
+        OPCUA_ItemINFO* uaItem = this->vUaItemInfo[i];
+        if(vUaNodeId[i].isNull())
+            continue;
+        OpcUa_DataValue &value = values[j++];
+        if (OpcUa_IsBad(value.StatusCode)) {
             errlogPrintf("%4d %s: Read item '%s' failed with status %s\n",uaItem->itemIdx,
                      uaItem->prec->name, uaItem->ItemPath,
-                     UaStatus(values[i].StatusCode).toString().toUtf8());
+                     UaStatus(value.StatusCode).toString().toUtf8());
         }
         else {
-            if(values[i].Value.ArrayType && !uaItem->isArray) {
-                 if(pMyClient->getDebug()) errlogPrintf("OpcUaSetupMonitors %s: Dont Support Array Data\n",uaItem->prec->name);
+            if(value.Value.ArrayType && !uaItem->isArray) {
+                 if(debug) errlogPrintf("OpcUaSetupMonitors %s: Dont Support Array Data\n",uaItem->prec->name);
             }
             else {
 
                 epicsMutexLock(uaItem->flagLock);
-                uaItem->itemDataType = (int) values[i].Value.Datatype;
+                uaItem->itemDataType = (int) value.Value.Datatype;
                 uaItem->isArray = 0;
+                setConversionPlan(uaItem);
                 epicsMutexUnlock(uaItem->flagLock);
-                if(pMyClient->getDebug() > 3) errlogPrintf("%4d %15s: %p flagSuppressWrite: %d\n",uaItem->itemIdx,uaItem->prec->name,uaItem,uaItem->flagSuppressWrite);
+                if(debug > 3) errlogPrintf("%4d %15s: %p flagSuppressWrite: %d\n",uaItem->itemIdx,uaItem->prec->name,uaItem,uaItem->flagSuppressWrite);
             }
         }
     }
-    pMyClient->createMonitoredItems();
+    this->preparePolls();
+    status = this->createMonitoredItems();
+    if(status.isBad()) {
+        errlogPrintf("OpcUaSetupMonitors: CreateMonitoredItems failed with status %s\n", status.toString().toUtf8());
+        return -1;
+    }
     return 0;
 }
 
@@ -1115,46 +2827,128 @@ long OpcUaSetupMonitors(void)
 long opcUa_close(int verbose)
 {
     UaStatus status;
-    if(verbose) errlogPrintf("opcUa_close()\n\tunsubscribe\n");
+    for(unsigned int i=0; i<vSessions.size(); i++) {
+        DevUaClient *pClient = vSessions[i];
+        if(verbose) errlogPrintf("opcUa_close() '%s'\n\tunsubscribe\n",pClient->name.c_str());
 
-    status = pMyClient->unsubscribe();
-    if(verbose) errlogPrintf("\tdisconnect\n");
-    status = pMyClient->disconnect();
+        status = pClient->unsubscribe();
+        if(verbose) errlogPrintf("\tdisconnect\n");
+        status = pClient->disconnect();
 
-    delete pMyClient;
-    pMyClient = NULL;
+        delete pClient;
+    }
+    vSessions.clear();
 
     if(verbose) errlogPrintf("\tcleanup\n");
     UaPlatformLayer::cleanup();
     return 0;
 }
 
-/* iocShell/Client: Setup an opcUa Item for the driver*/
-void addOPCUA_Item(OPCUA_ItemINFO *h)
+/* iocShell/Client: Setup an opcUa Item for the driver, in the session uaItem->session */
+long addOPCUA_Item(OPCUA_ItemINFO *h)
+{
+    if(h->session < 0 || h->session >= (int) vSessions.size()) {
+        errlogPrintf("%s addOPCUA_Item: no OpcUa session, see drvOpcuaSetup()\n",h->prec->name);
+        return 1;
+    }
+    vSessions[h->session]->addOPCUA_Item(h);
+    return 0;
+}
+
+/* Device support: get the index of a session, -1 if it isn't defined. Empty name: the first session */
+int getSession(const char *name)
+{
+    if(!name || !*name)
+        return vSessions.empty() ? -1 : 0;
+    for(unsigned int i=0; i<vSessions.size(); i++)
+        if(vSessions[i]->name == name)
+            return i;
+    return -1;
+}
+
+/* Device support: get the shared IOSCANPVT of an I/O scan group, create it on first use.
+ * Called by init_record only, so there is no need to lock.
+ */
+IOSCANPVT getIoScanGroup(const char *name)
+{
+    static std::map<std::string,IOSCANPVT> ioScanGroups;
+    std::map<std::string,IOSCANPVT>::iterator it = ioScanGroups.find(name);
+    if(it != ioScanGroups.end())
+        return it->second;
+    IOSCANPVT ioscanpvt;
+    scanIoInit(&ioscanpvt);
+    ioScanGroups[name] = ioscanpvt;
+    return ioscanpvt;
+}
+
+/* Device support: get the index of a subscription group, -1 if it isn't defined */
+int getSubscriptionGroup(const char *name)
+{
+    std::vector<SubscriptionGroup> &groups = getSubscriptionGroups();
+    for(unsigned int i=0; i<groups.size(); i++)
+        if(groups[i].name == name)
+            return i;
+    return -1;
+}
+
+/* Link option and iocShell: DataChangeFilter trigger "status", "value" or "timestamp", -1 if illegal */
+int parseTrigger(const char *str)
 {
-    pMyClient->addOPCUA_Item(h);
+    if(!strcmp(str, "status"))    return TRIGGER_STATUS;
+    if(!strcmp(str, "value"))     return TRIGGER_STATUSVALUE;
+    if(!strcmp(str, "timestamp")) return TRIGGER_STATUSVALUETIMESTAMP;
+    return -1;
+}
+
+/* Link option and iocShell: deadband "X" absolute or "X%" percent of EURange. Return the type, -1 if illegal */
+int parseDeadband(const char *str, double *value)
+{
+    char *end;
+    *value = strtod(str, &end);
+    if(end == str || *value < 0.0)
+        return -1;
+    if(*value == 0.0 && !*end)
+        return DEADBAND_NONE;
+    if(!*end)
+        return DEADBAND_ABSOLUTE;
+    if(!strcmp(end, "%") && *value <= 100.0)
+        return DEADBAND_PERCENT;
+    return -1;
 }
 
 /* iocShell/Client: Setup server url and certificates, connect and subscribe */
-long opcUa_init(UaString &g_serverUrl, UaString &g_applicationCertificate, UaString &g_applicationPrivateKey, UaString &nodeName, int autoConn,int debug=0)
+long opcUa_init(const char *sessionName, UaString &g_serverUrl, UaString &g_applicationCertificate, UaString &g_applicationPrivateKey, UaString &nodeName, int autoConn,int debug=0)
 {
     UaStatus status;
+    std::string name = (sessionName && *sessionName) ? sessionName : "default";
+    for(unsigned int i=0; i<vSessions.size(); i++) {
+        if(vSessions[i]->name == name) {
+            errlogPrintf("drvOpcuaSetup: ABORT Session '%s' already defined\n", name.c_str());
+            return 1;
+        }
+    }
     // Initialize the UA Stack platform layer
-    UaPlatformLayer::init();
+    if(vSessions.empty())
+        UaPlatformLayer::init();
 
     // Create instance of DevUaClient
-    pMyClient = new DevUaClient(autoConn,debug);
+    DevUaClient *pMyClient = new DevUaClient(autoConn,debug);
+    pMyClient->name = name;
+    vSessions.push_back(pMyClient);
 
     pMyClient->applicationCertificate = g_applicationCertificate;
     pMyClient->applicationPrivateKey  = g_applicationPrivateKey;
     pMyClient->hostName = nodeName;
     pMyClient->url = g_serverUrl;
     pMyClient->setDebug(debug);
+    if(autoConn) {      // connect and subscribe in the background, don't wait for the server
+        pMyClient->startSetup();
+        return 0;
+    }
     // Connect to OPC UA Server
     status = pMyClient->connect();
     if(status.isBad()) {
-        errlogPrintf("drvOpcuaSetup: Failed to connect to server '%s' - will retry every %f sec\n",
-                     g_serverUrl.toUtf8(), connectInterval);
+        errlogPrintf("drvOpcuaSetup: Failed to connect to server '%s'\n", g_serverUrl.toUtf8());
         return 1;
     }
     // Create subscription
@@ -1172,8 +2966,9 @@ static const iocshArg drvOpcuaSetupArg0 = {"[URL] to server", iocshArgString};
 static const iocshArg drvOpcuaSetupArg1 = {"[CERT_PATH] optional", iocshArgString};
 static const iocshArg drvOpcuaSetupArg2 = {"[HOST] optional", iocshArgString};
 static const iocshArg drvOpcuaSetupArg3 = {"Debug Level for library", iocshArgInt};
-static const iocshArg *const drvOpcuaSetupArg[4] = {&drvOpcuaSetupArg0,&drvOpcuaSetupArg1,&drvOpcuaSetupArg2,&drvOpcuaSetupArg3};
-iocshFuncDef drvOpcuaSetupFuncDef = {"drvOpcuaSetup", 4, drvOpcuaSetupArg};
+static const iocshArg drvOpcuaSetupArg4 = {"[SESSION] name, optional", iocshArgString};
+static const iocshArg *const drvOpcuaSetupArg[5] = {&drvOpcuaSetupArg0,&drvOpcuaSetupArg1,&drvOpcuaSetupArg2,&drvOpcuaSetupArg3,&drvOpcuaSetupArg4};
+iocshFuncDef drvOpcuaSetupFuncDef = {"drvOpcuaSetup", 5, drvOpcuaSetupArg};
 void drvOpcuaSetup (const iocshArgBuf *args )
 {
     UaString g_serverUrl;
@@ -1212,7 +3007,7 @@ void drvOpcuaSetup (const iocshArgBuf *args )
             g_defaultHostname = args[2].sval;
 
     g_certificateStorePath = args[1].sval;
-    int verbose = args[4].ival;
+    int verbose = args[3].ival;
 
     if(verbose) {
         errlogPrintf("Host:\t'%s'\n",g_defaultHostname.toUtf8());
@@ -1228,21 +3023,127 @@ void drvOpcuaSetup (const iocshArgBuf *args )
         }
     }
 
-    opcUa_init(g_serverUrl,g_applicationCertificate,g_applicationPrivateKey,g_defaultHostname,1,verbose);
+    opcUa_init(args[4].sval,g_serverUrl,g_applicationCertificate,g_applicationPrivateKey,g_defaultHostname,1,verbose);
 }
 extern "C" {
 epicsRegisterFunction(drvOpcuaSetup);
 }
 
+static const iocshArg opcuaSubscriptionArg0 = {"Name", iocshArgString};
+static const iocshArg opcuaSubscriptionArg1 = {"Publishing interval [ms]", iocshArgDouble};
+static const iocshArg opcuaSubscriptionArg2 = {"Priority (0..255)", iocshArgInt};
+static const iocshArg opcuaSubscriptionArg3 = {"Max. notifications per publish, 0: unlimited", iocshArgInt};
+static const iocshArg opcuaSubscriptionArg4 = {"Lifetime count, 0: default", iocshArgInt};
+static const iocshArg opcuaSubscriptionArg5 = {"Max. keep-alive count, 0: default", iocshArgInt};
+static const iocshArg *const opcuaSubscriptionArg[6] = {&opcuaSubscriptionArg0,&opcuaSubscriptionArg1,&opcuaSubscriptionArg2,
+                                                        &opcuaSubscriptionArg3,&opcuaSubscriptionArg4,&opcuaSubscriptionArg5};
+iocshFuncDef opcuaSubscriptionFuncDef = {"opcuaSubscription", 6, opcuaSubscriptionArg};
+void opcuaSubscription (const iocshArgBuf *args )
+{
+    if(subscriptionGroupsFixed) {
+        errlogPrintf("opcuaSubscription: ABORT Subscriptions have to be defined before drvOpcuaSetup()\n");
+        return;
+    }
+    if(args[0].sval == NULL || args[0].sval[0] == 0 || args[1].dval <= 0.0) {
+        errlogPrintf("opcuaSubscription: ABORT Missing argument \"name\" or \"publishing interval\"\n");
+        return;
+    }
+    if(args[2].ival < 0 || args[2].ival > 255 || args[3].ival < 0 || args[4].ival < 0 || args[5].ival < 0) {
+        errlogPrintf("opcuaSubscription: ABORT Illegal argument\n");
+        return;
+    }
+    std::vector<SubscriptionGroup> &groups = getSubscriptionGroups();
+    int idx = getSubscriptionGroup(args[0].sval);
+    if(idx < 0) {
+        SubscriptionGroup group;
+        group.name = args[0].sval;
+        group.trigger = TRIGGER_STATUSVALUE;
+        group.deadbandType = DEADBAND_NONE;
+        group.deadband = 0.0;
+        groups.push_back(group);
+        idx = groups.size()-1;
+    }
+    SubscriptionSettings &settings = groups[idx].settings;
+    settings.publishingInterval = args[1].dval;
+    settings.priority = (OpcUa_Byte) args[2].ival;
+    settings.maxNotificationsPerPublish = args[3].ival;
+    if(args[4].ival) settings.lifetimeCount = args[4].ival;
+    if(args[5].ival) settings.maxKeepAliveCount = args[5].ival;
+    return;
+}
+extern "C" {
+epicsRegisterFunction(opcuaSubscription);
+}
+
+static const iocshArg opcuaSubscriptionFilterArg0 = {"Name", iocshArgString};
+static const iocshArg opcuaSubscriptionFilterArg1 = {"Trigger status|value|timestamp", iocshArgString};
+static const iocshArg opcuaSubscriptionFilterArg2 = {"Deadband X or X%", iocshArgString};
+static const iocshArg *const opcuaSubscriptionFilterArg[3] = {&opcuaSubscriptionFilterArg0,&opcuaSubscriptionFilterArg1,&opcuaSubscriptionFilterArg2};
+iocshFuncDef opcuaSubscriptionFilterFuncDef = {"opcuaSubscriptionFilter", 3, opcuaSubscriptionFilterArg};
+void opcuaSubscriptionFilter (const iocshArgBuf *args )
+{
+    if(subscriptionGroupsFixed) {
+        errlogPrintf("opcuaSubscriptionFilter: ABORT Subscriptions have to be defined before drvOpcuaSetup()\n");
+        return;
+    }
+    int idx = args[0].sval ? getSubscriptionGroup(args[0].sval) : -1;
+    if(idx < 0) {
+        errlogPrintf("opcuaSubscriptionFilter: ABORT Subscription not defined\n");
+        return;
+    }
+    SubscriptionGroup &group = getSubscriptionGroups()[idx];
+    int trigger = TRIGGER_STATUSVALUE;
+    int deadbandType = DEADBAND_NONE;
+    double deadband = 0.0;
+    if(args[1].sval && args[1].sval[0] && (trigger = parseTrigger(args[1].sval)) < 0) {
+        errlogPrintf("opcuaSubscriptionFilter: ABORT Illegal trigger '%s'\n",args[1].sval);
+        return;
+    }
+    if(args[2].sval && args[2].sval[0] && (deadbandType = parseDeadband(args[2].sval, &deadband)) < 0) {
+        errlogPrintf("opcuaSubscriptionFilter: ABORT Illegal deadband '%s'\n",args[2].sval);
+        return;
+    }
+    group.trigger = trigger;
+    group.deadbandType = deadbandType;
+    group.deadband = deadband;
+    return;
+}
+extern "C" {
+epicsRegisterFunction(opcuaSubscriptionFilter);
+}
+
+static const iocshArg opcuaWriteBatchArg0 = {"[SESSION] name, empty: first session", iocshArgString};
+static const iocshArg opcuaWriteBatchArg1 = {"Batching window [ms], 0: off", iocshArgDouble};
+static const iocshArg opcuaWriteBatchArg2 = {"Max. items per write, 0: server limit", iocshArgInt};
+static const iocshArg *const opcuaWriteBatchArg[3] = {&opcuaWriteBatchArg0,&opcuaWriteBatchArg1,&opcuaWriteBatchArg2};
+iocshFuncDef opcuaWriteBatchFuncDef = {"opcuaWriteBatch", 3, opcuaWriteBatchArg};
+void opcuaWriteBatch (const iocshArgBuf *args )
+{
+    int idx = getSession(args[0].sval);
+    if(idx < 0) {
+        errlogPrintf("opcuaWriteBatch: ABORT Session not defined\n");
+        return;
+    }
+    if(args[1].dval < 0 || args[2].ival < 0) {
+        errlogPrintf("opcuaWriteBatch: ABORT Illegal parameter\n");
+        return;
+    }
+    vSessions[idx]->setWriteBatch(args[1].dval/1000.0, args[2].ival);
+    return;
+}
+extern "C" {
+epicsRegisterFunction(opcuaWriteBatch);
+}
+
 static const iocshArg opcuaDebugArg0 = {"Debug Level for library", iocshArgInt};
 static const iocshArg *const opcuaDebugArg[1] = {&opcuaDebugArg0};
 iocshFuncDef opcuaDebugFuncDef = {"opcuaDebug", 1, opcuaDebugArg};
 void opcuaDebug (const iocshArgBuf *args )
 {
-    if(pMyClient)
-        pMyClient->setDebug(args[0].ival);
-    else
+    if(vSessions.empty())
         errlogPrintf("Ignore: OpcUa not initialized\n");
+    for(unsigned int i=0; i<vSessions.size(); i++)
+        vSessions[i]->setDebug(args[0].ival);
     return;
 }
 extern "C" {
@@ -1254,13 +3155,68 @@ static const iocshArg *const opcuaStatArg[1] = {&opcuaStatArg0};
 iocshFuncDef opcuaStatFuncDef = {"opcuaStat", 1, opcuaStatArg};
 void opcuaStat (const iocshArgBuf *args )
 {
-    pMyClient->itemStat(args[0].ival);
+    for(unsigned int i=0; i<vSessions.size(); i++)
+        vSessions[i]->itemStat(args[0].ival);
+    nodeCacheReport();
     return;
 }
 extern "C" {
 epicsRegisterFunction(opcuaStat);
 }
 
+static const iocshArg opcuaTraceArg0 = {"Record name, \"*\" for all", iocshArgString};
+static const iocshArg opcuaTraceArg1 = {"On (1) / Off (0)", iocshArgInt};
+static const iocshArg *const opcuaTraceArg[2] = {&opcuaTraceArg0,&opcuaTraceArg1};
+iocshFuncDef opcuaTraceFuncDef = {"opcuaTrace", 2, opcuaTraceArg};
+void opcuaTrace (const iocshArgBuf *args )
+{
+    int n = 0;
+    if(vSessions.empty()) {
+        errlogPrintf("Ignore: OpcUa not initialized\n");
+        return;
+    }
+    for(unsigned int i=0; i<vSessions.size(); i++)
+        n += vSessions[i]->itemTrace(args[0].sval,args[1].ival);
+    if(!n)
+        errlogPrintf("opcuaTrace: no OpcUa record '%s'\n",args[0].sval);
+    return;
+}
+extern "C" {
+epicsRegisterFunction(opcuaTrace);
+}
+
+static const iocshArg opcuaTraceDumpArg0 = {"Number of entries, 0 for all", iocshArgInt};
+static const iocshArg *const opcuaTraceDumpArg[1] = {&opcuaTraceDumpArg0};
+iocshFuncDef opcuaTraceDumpFuncDef = {"opcuaTraceDump", 1, opcuaTraceDumpArg};
+void opcuaTraceDump (const iocshArgBuf *args )
+{
+    opcUaTraceDump(args[0].ival);
+    return;
+}
+extern "C" {
+epicsRegisterFunction(opcuaTraceDump);
+}
+
+static const iocshArg opcuaNodeCacheArg0 = {"Cache file", iocshArgString};
+static const iocshArg *const opcuaNodeCacheArg[1] = {&opcuaNodeCacheArg0};
+iocshFuncDef opcuaNodeCacheFuncDef = {"opcuaNodeCache", 1, opcuaNodeCacheArg};
+void opcuaNodeCache (const iocshArgBuf *args )
+{
+    if(!vSessions.empty()) {
+        errlogPrintf("opcuaNodeCache: ABORT must be called before drvOpcuaSetup()\n");
+        return;
+    }
+    if(!args[0].sval || !*args[0].sval) {
+        errlogPrintf("opcuaNodeCache: ABORT Missing Argument \"file\".\n");
+        return;
+    }
+    nodeCacheSetFile(args[0].sval);
+    return;
+}
+extern "C" {
+epicsRegisterFunction(opcuaNodeCache);
+}
+
 //create a static object to make shure that opcRegisterToIocShell is called on beginning of
 class OpcRegisterToIocShell
 {
@@ -1272,7 +3228,13 @@ OpcRegisterToIocShell::OpcRegisterToIocShell(void)
 {
     iocshRegister(&drvOpcuaSetupFuncDef, drvOpcuaSetup);
     iocshRegister(&opcuaDebugFuncDef, opcuaDebug);
+    iocshRegister(&opcuaSubscriptionFuncDef, opcuaSubscription);
+    iocshRegister(&opcuaSubscriptionFilterFuncDef, opcuaSubscriptionFilter);
     iocshRegister(&opcuaStatFuncDef, opcuaStat);
+    iocshRegister(&opcuaWriteBatchFuncDef, opcuaWriteBatch);
+    iocshRegister(&opcuaTraceFuncDef, opcuaTrace);
+    iocshRegister(&opcuaTraceDumpFuncDef, opcuaTraceDump);
+    iocshRegister(&opcuaNodeCacheFuncDef, opcuaNodeCache);
       //
 }
 static OpcRegisterToIocShell opcRegisterToIocShell;
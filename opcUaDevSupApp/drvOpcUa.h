@@ -32,17 +32,49 @@ extern "C" {
     extern long opcUa_close(int verbose);
     extern long OpcUaSetupMonitors(void);
     extern long opcUa_io_report (int); /* Write IO report output to stdout. */
-    extern void addOPCUA_Item(OPCUA_ItemINFO *h);
+    extern long addOPCUA_Item(OPCUA_ItemINFO *h);
+    extern int getSession(const char *name);
+    extern IOSCANPVT getIoScanGroup(const char *name);
+    extern int getSubscriptionGroup(const char *name);
+    extern int parseTrigger(const char *str);
+    extern int parseDeadband(const char *str, double *value);
 // iocShell:
     extern long OpcUaWriteItems(OPCUA_ItemINFO* uaItem);
+    #define OPCUA_WRITE_DEFERRED 2  /* OpcUaWriteItems: the session isn't set up yet, written later */
 // client:
     extern long OpcReadValues(int verbose,int monitored);
     extern long OpcWriteValue(int opcUaItemIndex,double val,int verbose);
     extern int maxDebug(int dbg,int recDbg);
 #ifdef __cplusplus
 }
-    extern long setRecVal(const UaVariant &val, OPCUA_ItemINFO* uaItem,int debug);
-    extern long opcUa_init(UaString &g_serverUrl, UaString &g_applicationCertificate, UaString &g_applicationPrivateKey, UaString &nodeName, int autoConn, int debug);
+    extern long setRecVal(const OpcUa_Variant &variant, OPCUA_ItemINFO* uaItem,int debug);
+    extern void setConversionPlan(OPCUA_ItemINFO* uaItem);
+    extern long appendSample(const OpcUa_DataValue &value, OPCUA_ItemINFO* uaItem);
+    extern void uaToEpicsTime(const OpcUa_DateTime &dt, epicsTimeStamp *pTime);
+    extern long opcUa_init(const char *sessionName, UaString &g_serverUrl, UaString &g_applicationCertificate, UaString &g_applicationPrivateKey, UaString &nodeName, int autoConn, int debug);
+
+    /* A service call over many items, split into chunks by runChunks(). runChunk() is called
+     * by several threads at once, each chunk writes its own part of the results only.
+     * A failed service call sets status by setStatus(), read it when runChunks() returned. */
+    class DevUaChunkJob {
+    public:
+        DevUaChunkJob() : status(OpcUa_Good), m_statusLock(epicsMutexMustCreate()) {}
+        virtual ~DevUaChunkJob() { epicsMutexDestroy(m_statusLock); }
+        virtual void runChunk(OpcUa_UInt32 first, OpcUa_UInt32 count) = 0;
+        OpcUa_StatusCode status;
+    protected:
+        void setStatus(OpcUa_StatusCode code) {
+            epicsMutexLock(m_statusLock);
+            status = code;
+            epicsMutexUnlock(m_statusLock);
+        }
+    private:
+        DevUaChunkJob(const DevUaChunkJob &);
+        DevUaChunkJob &operator=(const DevUaChunkJob &);
+        epicsMutexId m_statusLock;
+    };
+    extern OpcUa_UInt32 serviceChunk(OpcUa_UInt32 serverLimit);
+    extern void runChunks(DevUaChunkJob &job, OpcUa_UInt32 nItems, OpcUa_UInt32 chunk);
 #endif
 
 #endif /* ifndef __DRVOPCUA_H */
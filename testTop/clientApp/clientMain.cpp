@@ -169,7 +169,7 @@ int main(int argc, char* argv[], char *envp[])
         printf("Client privat key:\n\t'%s'\n",g_applicationPrivateKey.toUtf8());
     }
 
-    result = opcUa_init(g_serverUrl,g_applicationCertificate,g_applicationPrivateKey,g_defaultHostname,0,verbose);
+    result = opcUa_init(NULL,g_serverUrl,g_applicationCertificate,g_applicationPrivateKey,g_defaultHostname,0,verbose);
     if(result)
     {
         printf("Error in opcUa_init()");